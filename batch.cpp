@@ -0,0 +1,169 @@
+#include "batch.h"
+
+#ifdef __APPLE__
+#define GL_SILENCE_DEPRECATION
+#include <GLFW/glfw3.h>
+#else
+#include "glfw\glfw3.h"
+#include <gl\GL.h>
+#endif
+
+#include <vector>
+
+namespace Graph
+{
+namespace Batch
+{
+	struct Run
+	{
+		Primitive primitive;
+		unsigned int texture;
+		float lineWidth;
+		float alphaTest;
+
+		unsigned int first;
+		unsigned int count;
+	};
+
+	static std::vector<Vertex> g_Vertices;
+	static std::vector<Run> g_Runs;
+
+	static float g_LineWidth = 1.0f;
+	static float g_AlphaTest = 0.0f;
+
+	static GLenum GLMode(Primitive primitive)
+	{
+		switch (primitive)
+		{
+		case Lines:
+			return GL_LINES;
+		case Quads:
+			return GL_QUADS;
+		case Triangles:
+		default:
+			return GL_TRIANGLES;
+		}
+	}
+
+	Vertex* Append(Primitive primitive, unsigned int texture, unsigned int count)
+	{
+		if (g_Vertices.size() + count > MaxVertices)
+		{
+			Flush();
+		}
+
+		const unsigned int first = (unsigned int)g_Vertices.size();
+
+		Run* last = g_Runs.empty() ? nullptr : &g_Runs.back();
+
+		if (last &&
+			last->primitive == primitive &&
+			last->texture == texture &&
+			last->alphaTest == g_AlphaTest &&
+			(primitive != Lines || last->lineWidth == g_LineWidth))
+		{
+			last->count += count;
+		}
+		else
+		{
+			Run run = { primitive, texture, g_LineWidth, g_AlphaTest, first, count };
+			g_Runs.push_back(run);
+		}
+
+		g_Vertices.resize(first + count);
+
+		return &g_Vertices[first];
+	}
+
+	void SetLineWidth(float width)
+	{
+		g_LineWidth = width;
+	}
+
+	void SetAlphaTest(float reference)
+	{
+		g_AlphaTest = reference;
+	}
+
+	void Flush()
+	{
+		if (g_Runs.empty())
+			return;
+
+		const Vertex* vertices = g_Vertices.data();
+
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+
+		glVertexPointer(2, GL_FLOAT, sizeof(Vertex), &vertices->x);
+		glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), &vertices->u);
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), &vertices->r);
+
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		unsigned int boundTexture = 0;
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		float lineWidth = -1.0f;
+		float alphaTest = 0.0f;
+
+		for (const Run& run : g_Runs)
+		{
+			if (run.texture != boundTexture)
+			{
+				glBindTexture(GL_TEXTURE_2D, run.texture);
+				boundTexture = run.texture;
+			}
+
+			if (run.primitive == Lines && run.lineWidth != lineWidth)
+			{
+				glLineWidth(run.lineWidth);
+				lineWidth = run.lineWidth;
+			}
+
+			if (run.alphaTest != alphaTest)
+			{
+				// Alpha tested runs (distance field text) are opaque where the test passes,
+				// blending them would make the texture alpha their opacity
+				if (run.alphaTest > 0.0f)
+				{
+					glEnable(GL_ALPHA_TEST);
+					glAlphaFunc(GL_GREATER, run.alphaTest);
+					glDisable(GL_BLEND);
+				}
+				else
+				{
+					glDisable(GL_ALPHA_TEST);
+					glEnable(GL_BLEND);
+				}
+				alphaTest = run.alphaTest;
+			}
+
+			glDrawArrays(GLMode(run.primitive), run.first, run.count);
+		}
+
+		// Restore the state the rest of the library expects
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+
+		glDisable(GL_BLEND);
+		glDisable(GL_ALPHA_TEST);
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glLineWidth(g_LineWidth);
+
+		Discard();
+	}
+
+	void Discard()
+	{
+		g_Vertices.clear();
+		g_Runs.clear();
+	}
+
+} // namespace Batch
+} // namespace Graph
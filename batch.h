@@ -0,0 +1,68 @@
+#pragma once
+
+namespace Graph
+{
+	// Draw command recorder
+	//
+	// Primitives are appended to one client-side vertex array and sent to GL with
+	// one glDrawArrays per run of vertices sharing primitive kind, texture, line width
+	// and alpha test.
+	// Runs keep the drawing order, the recorder is flushed on SwapBuffers
+	// and before anything draws with GL directly.
+	namespace Batch
+	{
+		// Recorded vertices are flushed once there are this many of them
+		const unsigned int MaxVertices = 1 << 18;
+
+		enum Primitive
+		{
+			Lines,
+			Triangles,
+			Quads
+		};
+
+		struct Vertex
+		{
+			float x, y;
+			float u, v;
+			unsigned char r, g, b, a;
+		};
+
+		// Returns room for count vertices of the primitive drawn with the texture (0 - no texture).
+		// The pointer is valid until the next call to the recorder
+		Vertex* Append(Primitive primitive, unsigned int texture, unsigned int count);
+
+		// Line width for all lines appended after the call
+		void SetLineWidth(float width);
+
+		// Alpha test for all primitives appended after the call: fragments with alpha
+		// not greater than reference are dropped, the rest are drawn opaque without blending
+		// (0 - no alpha test)
+		void SetAlphaTest(float reference);
+
+		// Draws all recorded vertices
+		void Flush();
+
+		// Drops recorded vertices (e.g. when the buffer is cleared anyway)
+		void Discard();
+
+		inline void Put(Vertex& v, float x, float y, unsigned long color)
+		{
+			v.x = x;
+			v.y = y;
+			v.u = 0.0f;
+			v.v = 0.0f;
+			v.r = (unsigned char)color;
+			v.g = (unsigned char)(color >> 8);
+			v.b = (unsigned char)(color >> 16);
+			v.a = 0xff;
+		}
+
+		inline void Put(Vertex& v, float x, float y, float u, float tv, unsigned long color)
+		{
+			Put(v, x, y, color);
+			v.u = u;
+			v.v = tv;
+		}
+	}
+}
@@ -6,7 +6,16 @@ cd g_build
 
 %GPP% -std=c++14 -c -I..\include ..\glfwbgi.cpp
 %GPP% -std=c++14 -c -I..\include ..\lodepng.cpp
+%GPP% -std=c++14 -c -I..\include ..\batch.cpp
+%GPP% -std=c++14 -c -I..\include ..\threadpool.cpp
+%GPP% -std=c++14 -c -I..\include ..\mappedfile.cpp
+%GPP% -std=c++14 -c -I..\include ..\pixels.cpp
+%GPP% -std=c++14 -c -I..\include ..\imagecache.cpp
+%GPP% -std=c++14 -c -I..\include ..\bundle.cpp
+%GPP% -std=c++14 -c -I..\include ..\glfuncs.cpp
 
-%LD% -r -o libglfwbgi.a glfwbgi.o lodepng.o ..\lib\mingw-w64\x64\libglfw3.a
+%LD% -r -o libglfwbgi.a glfwbgi.o lodepng.o batch.o threadpool.o mappedfile.o pixels.o imagecache.o bundle.o glfuncs.o ..\lib\mingw-w64\x64\libglfw3.a
 
 %GPP% -std=c++14 -o ..\test_gpp.exe  -I. ..\glfwtest.cpp -L. -lglfwbgi -lmingw32 -lopengl32 -lgdi32 -luser32
+
+%GPP% -std=c++14 -o ..\bundletool.exe ..\bundletool.cpp ..\lodepng.cpp
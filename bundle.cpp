@@ -0,0 +1,113 @@
+#include "bundle.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+namespace Graph
+{
+	using namespace BundleFormat;
+
+	Bundle::Bundle() noexcept
+		: m_Entries(nullptr)
+		, m_Count(0)
+	{
+	}
+
+	bool Bundle::Open(const char* filename)
+	{
+		Close();
+
+		if (!m_File.Open(filename))
+		{
+			return false;
+		}
+
+		const unsigned char* data = m_File.Data();
+		const size_t size = m_File.Size();
+
+		Header header;
+		if (size < sizeof(header))
+		{
+			printf("Error. File [%s] is not a bundle\n", filename);
+			Close();
+			return false;
+		}
+
+		memcpy(&header, data, sizeof(header));
+
+		if (header.magic != Magic || header.version != Version)
+		{
+			printf("Error. File [%s] is not a bundle or has unsupported version\n", filename);
+			Close();
+			return false;
+		}
+
+		if ((size - sizeof(header)) / sizeof(Entry) < header.count)
+		{
+			printf("Error. Bundle [%s] is truncated\n", filename);
+			Close();
+			return false;
+		}
+
+		// Entries follow the 16-byte header and are used in place
+		const Entry* entries = (const Entry*)(data + sizeof(header));
+
+		for (uint32_t i = 0; i < header.count; ++i)
+		{
+			const Entry& entry = entries[i];
+			if (entry.nameOffset > size || size - entry.nameOffset < entry.nameLength ||
+				entry.dataOffset > size || size - entry.dataOffset < entry.dataSize)
+			{
+				printf("Error. Bundle [%s] has a broken entry %u\n", filename, i);
+				Close();
+				return false;
+			}
+		}
+
+		m_Entries = entries;
+		m_Count = header.count;
+
+		return true;
+	}
+
+	void Bundle::Close()
+	{
+		m_File.Close();
+		m_Entries = nullptr;
+		m_Count = 0;
+	}
+
+	const char* Bundle::Name(const Entry& entry) const
+	{
+		return (const char*)m_File.Data() + entry.nameOffset;
+	}
+
+	const Entry* Bundle::Find(const char* name) const
+	{
+		const size_t length = strlen(name);
+
+		// Names are sorted as byte strings, shorter prefix first
+		auto less = [this](const Entry& entry, const std::pair<const char*, size_t>& key)
+		{
+			const int cmp = memcmp(Name(entry), key.first, std::min<size_t>(entry.nameLength, key.second));
+			return cmp < 0 || (cmp == 0 && entry.nameLength < key.second);
+		};
+
+		const std::pair<const char*, size_t> key(name, length);
+		const Entry* end = m_Entries + m_Count;
+		const Entry* it = std::lower_bound(m_Entries, end, key, less);
+
+		if (it == end || it->nameLength != length || memcmp(Name(*it), name, length) != 0)
+		{
+			return nullptr;
+		}
+
+		return it;
+	}
+
+	const unsigned char* Bundle::Data(const Entry& entry) const
+	{
+		return m_File.Data() + entry.dataOffset;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "mappedfile.h"
+
+#include <cstdint>
+#include <cstddef>
+
+namespace Graph
+{
+	// Asset bundle: many files packed into one file with a sorted index.
+	//
+	// Layout: Header, Entry[count] sorted by name, entry names, then the entry data,
+	// each entry aligned to DataAlignment bytes. All numbers are little-endian.
+	namespace BundleFormat
+	{
+		const uint32_t Magic = 0x4e424247; // "GBBN"
+		const uint32_t Version = 1;
+
+		const size_t DataAlignment = 16;
+
+		enum EntryType
+		{
+			// File contents as is (PNG, BMP, fonts, ...)
+			Raw = 0,
+			// Decoded RGBA pixels, top row first
+			RGBA = 1
+		};
+
+		struct Header
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint32_t count;
+			uint32_t reserved;
+		};
+
+		struct Entry
+		{
+			uint64_t dataOffset;
+			uint64_t dataSize;
+			uint32_t nameOffset;
+			uint32_t nameLength;
+			uint32_t type;
+			uint32_t width;
+			uint32_t height;
+			uint32_t reserved;
+		};
+	}
+
+	// Read-only view of a memory-mapped bundle
+	class Bundle
+	{
+	public:
+		Bundle() noexcept;
+
+		bool Open(const char* filename);
+		void Close();
+
+		// Binary search in the index, nullptr if there is no such entry
+		const BundleFormat::Entry* Find(const char* name) const;
+
+		// Entry data inside the mapping, valid while the bundle is open
+		const unsigned char* Data(const BundleFormat::Entry& entry) const;
+
+	private:
+		const char* Name(const BundleFormat::Entry& entry) const;
+
+		MappedFile m_File;
+
+		const BundleFormat::Entry* m_Entries;
+		uint32_t m_Count;
+	};
+}
@@ -0,0 +1,185 @@
+// Packs files into an asset bundle (see bundle.h)
+//
+// Usage: bundletool [-d] output.bundle file...
+//   -d  store PNG images decoded (RGBA), so they are uploaded without decoding at run time
+//
+// Entries are named by the file path as given, with '\' replaced by '/'.
+
+#include "bundle.h"
+#include "lodepng.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace Graph::BundleFormat;
+
+struct Item
+{
+	std::string path;
+	std::string name;
+};
+
+static bool ReadFile(const std::string& path, std::vector<unsigned char>& data)
+{
+	unsigned err = lodepng::load_file(data, path);
+	if (err)
+	{
+		printf("Error [%u] reading file [%s]\n", err, path.c_str());
+		return false;
+	}
+	return true;
+}
+
+static bool IsPNG(const std::string& path)
+{
+	const size_t dot = path.rfind('.');
+	if (dot == std::string::npos)
+		return false;
+
+	std::string ext = path.substr(dot);
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+	return ext == ".png";
+}
+
+static bool WritePadding(FILE* file, uint64_t& offset)
+{
+	static const unsigned char zeros[DataAlignment] = {};
+	const size_t padding = (size_t)((DataAlignment - offset % DataAlignment) % DataAlignment);
+	offset += padding;
+	return fwrite(zeros, 1, padding, file) == padding;
+}
+
+int main(int argc, char** argv)
+{
+	bool decode = false;
+	int arg = 1;
+
+	if (arg < argc && strcmp(argv[arg], "-d") == 0)
+	{
+		decode = true;
+		++arg;
+	}
+
+	if (argc - arg < 2)
+	{
+		printf("Usage: %s [-d] output.bundle file...\n", argv[0]);
+		return 1;
+	}
+
+	const char* output = argv[arg++];
+
+	std::vector<Item> items;
+	for (; arg < argc; ++arg)
+	{
+		Item item;
+		item.path = argv[arg];
+		item.name = item.path;
+		std::replace(item.name.begin(), item.name.end(), '\\', '/');
+		items.push_back(item);
+	}
+
+	// The index is searched with a binary search by name
+	std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) { return a.name < b.name; });
+
+	for (size_t i = 1; i < items.size(); ++i)
+	{
+		if (items[i].name == items[i - 1].name)
+		{
+			printf("Error. File [%s] is listed twice\n", items[i].name.c_str());
+			return 1;
+		}
+	}
+
+	Header header = {};
+	header.magic = Magic;
+	header.version = Version;
+	header.count = (uint32_t)items.size();
+
+	std::vector<Entry> entries(items.size());
+
+	uint64_t offset = sizeof(Header) + sizeof(Entry) * items.size();
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		entries[i].nameOffset = (uint32_t)offset;
+		entries[i].nameLength = (uint32_t)items[i].name.size();
+		offset += items[i].name.size();
+	}
+
+	FILE* file = fopen(output, "wb");
+	if (!file)
+	{
+		printf("Error creating file [%s]\n", output);
+		return 1;
+	}
+
+	// The index is written last, when data offsets are known
+	bool ok = fseek(file, (long)offset, SEEK_SET) == 0;
+
+	for (size_t i = 0; ok && i < items.size(); ++i)
+	{
+		std::vector<unsigned char> data;
+		if (!ReadFile(items[i].path, data))
+		{
+			ok = false;
+			break;
+		}
+
+		Entry& entry = entries[i];
+		entry.type = Raw;
+
+		if (decode && IsPNG(items[i].path))
+		{
+			std::vector<unsigned char> pixels;
+			unsigned width = 0;
+			unsigned height = 0;
+			unsigned err = lodepng::decode(pixels, width, height, data);
+			if (err)
+			{
+				printf("Error [%u] decoding file [%s]\n", err, items[i].path.c_str());
+				ok = false;
+				break;
+			}
+
+			data.swap(pixels);
+			entry.type = RGBA;
+			entry.width = width;
+			entry.height = height;
+		}
+
+		ok = WritePadding(file, offset);
+
+		entry.dataOffset = offset;
+		entry.dataSize = data.size();
+
+		ok = ok && fwrite(data.data(), 1, data.size(), file) == data.size();
+		offset += data.size();
+
+		printf("%s: %s, %llu bytes\n", items[i].name.c_str(), entry.type == RGBA ? "rgba" : "raw", (unsigned long long)data.size());
+	}
+
+	ok = ok &&
+		fseek(file, 0, SEEK_SET) == 0 &&
+		fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(entries.data(), sizeof(Entry), entries.size(), file) == entries.size();
+
+	for (size_t i = 0; ok && i < items.size(); ++i)
+	{
+		ok = fwrite(items[i].name.data(), 1, items[i].name.size(), file) == items[i].name.size();
+	}
+
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok)
+	{
+		printf("Error writing file [%s]\n", output);
+		remove(output);
+		return 1;
+	}
+
+	printf("%s: %u entries, %llu bytes\n", output, header.count, (unsigned long long)offset);
+	return 0;
+}
@@ -1,4 +1,6 @@
 #include "freetype.h"
+#include "batch.h"
+#include "packer.h"
 
 #ifdef __APPLE__
 #define GL_SILENCE_DEPRECATION
@@ -9,18 +11,850 @@
 
 #include "ft2build.h"
 #include FT_FREETYPE_H
+#include FT_SIZES_H
+#include FT_ADVANCES_H
 //#include <freetype/freetype.h>
 
 
+#include <cstdint>
 #include <vector>
+#include <unordered_map>
+#include <list>
+#include <algorithm>
+#include <type_traits>
 #include <iostream>
 
 namespace Graph
 {
+	namespace
+	{
+		// Glyph atlas
+		//
+		// Rendered glyphs are kept in a few big textures (pages) and looked up by
+		// (face, pixel size, glyph index), so FreeType rasterization and texture upload
+		// happen only once per glyph.
+
+		const int AtlasPageSize = 512;
+		const int AtlasPadding = 1;
+
+		// Set in GlyphKey::size for distance field glyphs
+		const unsigned int DistanceFieldFlag = 0x80000000u;
+
+		// Distance field values above the edge (128) are inside the glyph
+		const float DistanceFieldEdge = 0.5f;
+
+		struct GlyphKey
+		{
+			const void* face;
+			unsigned int size;
+			unsigned int glyph;
+
+			bool operator==(const GlyphKey& other) const
+			{
+				return face == other.face && size == other.size && glyph == other.glyph;
+			}
+		};
+
+		struct GlyphKeyHash
+		{
+			size_t operator()(const GlyphKey& key) const
+			{
+				size_t h = std::hash<const void*>()(key.face);
+				h ^= (size_t)key.size * 0x9E3779B1u + (h << 6) + (h >> 2);
+				h ^= (size_t)key.glyph * 0x85EBCA77u + (h << 6) + (h >> 2);
+				return h;
+			}
+		};
+
+		struct GlyphInfo
+		{
+			unsigned int page;
+
+			float u0, v0, u1, v1;
+
+			int width;
+			int height;
+			int left;
+			int top;
+		};
+
+		struct AtlasPage
+		{
+			GLuint texture;
+			int width;
+			int height;
+			ShelfPacker packer;
+
+			// Distance field pages are sampled with linear filtering
+			bool distanceField;
+		};
+
+		class GlyphAtlas
+		{
+		public:
+			const GlyphInfo* Find(const GlyphKey& key) const
+			{
+				auto it = m_Glyphs.find(key);
+				return it != m_Glyphs.end() ? &it->second : nullptr;
+			}
+
+			// Copies the glyph rendered in the slot into the atlas
+			const GlyphInfo* Insert(const GlyphKey& key, const FT_GlyphSlot slot)
+			{
+				const bool distanceField = (key.size & DistanceFieldFlag) != 0;
+
+				const FT_Bitmap& bitmap = slot->bitmap;
+
+				GlyphInfo info;
+				info.page = 0;
+				info.u0 = info.v0 = info.u1 = info.v1 = 0.0f;
+				info.width = bitmap.width;
+				info.height = bitmap.rows;
+				info.left = slot->bitmap_left;
+				info.top = slot->bitmap_top;
+
+				if (info.width > 0 && info.height > 0)
+				{
+					int x = 0;
+					int y = 0;
+					if (!Allocate(info.width + AtlasPadding, info.height + AtlasPadding, distanceField, info.page, x, y))
+					{
+						return nullptr;
+					}
+
+					Upload(m_Pages[info.page], x, y, bitmap);
+
+					const AtlasPage& page = m_Pages[info.page];
+					info.u0 = (float)x / page.width;
+					info.v0 = (float)y / page.height;
+					info.u1 = (float)(x + info.width) / page.width;
+					info.v1 = (float)(y + info.height) / page.height;
+				}
+
+				return &(m_Glyphs[key] = info);
+			}
+
+			GLuint Texture(unsigned int page) const
+			{
+				return m_Pages[page].texture;
+			}
+
+			// Drops all glyphs of the face (the face pointer can be reused by another font)
+			void Forget(const void* face)
+			{
+				for (auto it = m_Glyphs.begin(); it != m_Glyphs.end(); )
+				{
+					if (it->first.face == face)
+						it = m_Glyphs.erase(it);
+					else
+						++it;
+				}
+			}
+
+			void Release()
+			{
+				Batch::Discard();
+
+				for (auto& page : m_Pages)
+				{
+					glDeleteTextures(1, &page.texture);
+				}
+
+				m_Pages.clear();
+				m_Glyphs.clear();
+			}
+
+		private:
+			bool Allocate(int width, int height, bool distanceField, unsigned int& page, int& x, int& y)
+			{
+				for (unsigned int i = 0; i < m_Pages.size(); ++i)
+				{
+					if (m_Pages[i].distanceField == distanceField && m_Pages[i].packer.Insert(width, height, x, y))
+					{
+						page = i;
+						return true;
+					}
+				}
+
+				// Huge glyphs get a page of their own
+				int size = AtlasPageSize;
+				while (size < width || size < height)
+					size *= 2;
+
+				AtlasPage newPage = { 0, size, size, ShelfPacker(size, size), distanceField };
+
+				std::vector<unsigned char> empty(size * size, 0);
+
+				glGenTextures(1, &newPage.texture);
+				glBindTexture(GL_TEXTURE_2D, newPage.texture);
+
+				const GLint filter = distanceField ? GL_LINEAR : GL_NEAREST;
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+
+				// Coverage (or distance) only, color comes from the vertex color (GL_MODULATE)
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, size, size, 0, GL_ALPHA, GL_UNSIGNED_BYTE, empty.data());
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+				glBindTexture(GL_TEXTURE_2D, 0);
+
+				if (newPage.texture == 0 || !newPage.packer.Insert(width, height, x, y))
+				{
+					std::cerr << "FT2: glyph atlas page allocation failed" << std::endl;
+					glDeleteTextures(1, &newPage.texture);
+					return false;
+				}
+
+				page = (unsigned int)m_Pages.size();
+				m_Pages.push_back(newPage);
+				return true;
+			}
+
+			static void Upload(const AtlasPage& page, int x, int y, const FT_Bitmap& bitmap)
+			{
+				glBindTexture(GL_TEXTURE_2D, page.texture);
+
+				// FreeType rows are uploaded in place: tightly packed bytes, pitch apart
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, bitmap.pitch);
+
+				glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, bitmap.width, bitmap.rows, GL_ALPHA, GL_UNSIGNED_BYTE, bitmap.buffer);
+
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+				glBindTexture(GL_TEXTURE_2D, 0);
+			}
+
+		private:
+			std::vector<AtlasPage> m_Pages;
+			std::unordered_map<GlyphKey, GlyphInfo, GlyphKeyHash> m_Glyphs;
+		};
+
+		GlyphAtlas g_GlyphAtlas;
+
+		struct GlyphQuad
+		{
+			const GlyphInfo* glyph;
+			float x;
+			float y;
+		};
+
+		// Text layout cache
+		//
+		// Positioned glyph runs of recently drawn strings, keyed by (face, pixel size, text),
+		// so drawing the same label again only translates the cached quads.
+		// Quads point into the glyph atlas, the layouts of a face are dropped together
+		// with its glyphs.
+		const size_t MaxLayouts = 1024;
+
+		struct LayoutKey
+		{
+			const void* face;
+			unsigned int size;
+
+			// Characters as raw bytes, for both narrow and wide strings
+			std::string text;
+			unsigned int charSize;
+
+			bool operator==(const LayoutKey& other) const
+			{
+				return face == other.face && size == other.size &&
+					charSize == other.charSize && text == other.text;
+			}
+		};
+
+		struct LayoutKeyHash
+		{
+			size_t operator()(const LayoutKey& key) const
+			{
+				size_t h = std::hash<std::string>()(key.text);
+				h ^= std::hash<const void*>()(key.face) + (h << 6) + (h >> 2);
+				h ^= (size_t)key.size * 0x9E3779B1u + key.charSize + (h << 6) + (h >> 2);
+				return h;
+			}
+		};
+
+		struct TextLayout
+		{
+			// Quads relative to the pen position
+			std::vector<GlyphQuad> quads;
+			float advance;
+		};
+
+		class LayoutCache
+		{
+		public:
+			const TextLayout* Find(const LayoutKey& key)
+			{
+				auto it = m_Index.find(key);
+				if (it == m_Index.end())
+					return nullptr;
+
+				// Most recently used go first
+				m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+				return &it->second->second;
+			}
+
+			const TextLayout* Insert(const LayoutKey& key, TextLayout&& layout)
+			{
+				if (m_Entries.size() >= MaxLayouts)
+				{
+					m_Index.erase(m_Entries.back().first);
+					m_Entries.pop_back();
+				}
+
+				m_Entries.emplace_front(key, std::move(layout));
+				m_Index[key] = m_Entries.begin();
+				return &m_Entries.front().second;
+			}
+
+			void Forget(const void* face)
+			{
+				for (auto it = m_Entries.begin(); it != m_Entries.end(); )
+				{
+					if (it->first.face == face)
+					{
+						m_Index.erase(it->first);
+						it = m_Entries.erase(it);
+					}
+					else
+					{
+						++it;
+					}
+				}
+			}
+
+			void Clear()
+			{
+				m_Index.clear();
+				m_Entries.clear();
+			}
+
+		private:
+			typedef std::list<std::pair<LayoutKey, TextLayout> > Entries;
+
+			Entries m_Entries;
+			std::unordered_map<LayoutKey, Entries::iterator, LayoutKeyHash> m_Index;
+		};
+
+		LayoutCache g_LayoutCache;
+
+		// Fonts held by other modules' statics may be destroyed after the caches at exit,
+		// they must not touch them then. Defined after the caches, so it's destroyed first
+		bool g_CachesAlive = false;
+
+		struct CachesLifetime
+		{
+			CachesLifetime() { g_CachesAlive = true; }
+			~CachesLifetime() { g_CachesAlive = false; }
+		} g_CachesLifetime;
+
+		// Records the quads scaled and moved to (x, y), one run (texture bind) per atlas page
+		void DrawGlyphQuads(const std::vector<GlyphQuad>& quads, float x, float y, float scale, unsigned long color)
+		{
+			std::vector<bool> done(quads.size(), false);
+
+			for (size_t first = 0; first < quads.size(); ++first)
+			{
+				if (done[first])
+					continue;
+
+				const unsigned int page = quads[first].glyph->page;
+
+				unsigned int count = 0;
+				for (size_t i = first; i < quads.size(); ++i)
+				{
+					if (!done[i] && quads[i].glyph->page == page)
+						++count;
+				}
+
+				Batch::Vertex* v = Batch::Append(Batch::Quads, g_GlyphAtlas.Texture(page), count * 4);
+
+				for (size_t i = first; i < quads.size(); ++i)
+				{
+					const GlyphQuad& q = quads[i];
+					if (done[i] || q.glyph->page != page)
+						continue;
+
+					const GlyphInfo& g = *q.glyph;
+
+					const float qx = x + q.x * scale;
+					const float qy = y + q.y * scale;
+					const float qw = g.width * scale;
+					const float qh = g.height * scale;
+
+					Batch::Put(*v++, qx, qy, g.u0, g.v0, color);
+					Batch::Put(*v++, qx + qw, qy, g.u1, g.v0, color);
+					Batch::Put(*v++, qx + qw, qy + qh, g.u1, g.v1, color);
+					Batch::Put(*v++, qx, qy + qh, g.u0, g.v1, color);
+
+					done[i] = true;
+				}
+			}
+		}
+
+		// Sizes of one face
+		//
+		// Every pixel size gets its own FT_Size, so switching between sizes is
+		// FT_Activate_Size instead of recomputing the scaled metrics with FT_Set_Pixel_Sizes.
+		// The least recently used size is dropped when there are too many.
+		const size_t MaxSizesPerFace = 16;
+
+		struct SizeCache
+		{
+			struct Entry
+			{
+				unsigned int pixels;
+				FT_Size size;
+				unsigned long lastUse;
+			};
+
+			std::vector<Entry> entries;
+			unsigned long clock = 0;
+		};
+
+		bool ActivateSize(FT_Face face, SizeCache& cache, unsigned int pixels)
+		{
+			++cache.clock;
+
+			for (auto& entry : cache.entries)
+			{
+				if (entry.pixels == pixels)
+				{
+					entry.lastUse = cache.clock;
+
+					if (face->size != entry.size)
+					{
+						FT_Activate_Size(entry.size);
+					}
+					return true;
+				}
+			}
+
+			if (cache.entries.size() >= MaxSizesPerFace)
+			{
+				auto oldest = std::min_element(cache.entries.begin(), cache.entries.end(),
+					[](const SizeCache::Entry& a, const SizeCache::Entry& b) { return a.lastUse < b.lastUse; });
+
+				FT_Done_Size(oldest->size);
+				cache.entries.erase(oldest);
+			}
+
+			FT_Size size;
+			int error = FT_New_Size(face, &size);
+			if (error)
+			{
+				std::cerr << "FT2: new size error: " << error << std::endl;
+				return false;
+			}
+
+			FT_Activate_Size(size);
+
+			error = FT_Set_Pixel_Sizes(
+				face,        /* handle to face object */
+				0,           /* pixel_width           */
+				pixels);     /* pixel_height          */
+			if (error)
+			{
+				std::cerr << "set pixel size error: " << error << std::endl;
+				FT_Done_Size(size);
+				return false;
+			}
+
+			SizeCache::Entry entry = { pixels, size, cache.clock };
+			cache.entries.push_back(entry);
+			return true;
+		}
+
+		// Glyph indices of one face
+		//
+		// Open addressing with linear probing, so a repeated character costs a hash and
+		// usually one probe instead of FreeType's charmap binary search.
+		class GlyphIndexMap
+		{
+		public:
+			FT_UInt Find(FT_Face face, uint32_t codepoint)
+			{
+				if (m_Slots.empty())
+				{
+					m_Slots.resize(InitialSlots, Slot{ EmptySlot, 0 });
+				}
+
+				const size_t mask = m_Slots.size() - 1;
+				for (size_t i = Hash(codepoint) & mask; ; i = (i + 1) & mask)
+				{
+					Slot& slot = m_Slots[i];
+					if (slot.codepoint == codepoint)
+						return slot.glyph;
+
+					if (slot.codepoint == EmptySlot)
+						break;
+				}
+
+				const FT_UInt glyph = FT_Get_Char_Index(face, codepoint);
+
+				// Kept at most 3/4 full
+				if ((m_Count + 1) * 4 > m_Slots.size() * 3)
+				{
+					Grow();
+				}
+
+				Place(codepoint, glyph);
+				++m_Count;
+
+				return glyph;
+			}
+
+		private:
+			static const uint32_t EmptySlot = 0xFFFFFFFFu;
+			static const size_t InitialSlots = 256;
+
+			struct Slot
+			{
+				uint32_t codepoint;
+				FT_UInt glyph;
+			};
+
+			static size_t Hash(uint32_t codepoint)
+			{
+				return (size_t)(codepoint * 0x9E3779B1u) >> 7;
+			}
+
+			void Place(uint32_t codepoint, FT_UInt glyph)
+			{
+				const size_t mask = m_Slots.size() - 1;
+				size_t i = Hash(codepoint) & mask;
+				while (m_Slots[i].codepoint != EmptySlot)
+				{
+					i = (i + 1) & mask;
+				}
+
+				m_Slots[i].codepoint = codepoint;
+				m_Slots[i].glyph = glyph;
+			}
+
+			void Grow()
+			{
+				std::vector<Slot> old(m_Slots.size() * 2, Slot{ EmptySlot, 0 });
+				old.swap(m_Slots);
+
+				for (const Slot& slot : old)
+				{
+					if (slot.codepoint != EmptySlot)
+						Place(slot.codepoint, slot.glyph);
+				}
+			}
+
+			std::vector<Slot> m_Slots;
+			size_t m_Count = 0;
+		};
+
+		// UTF-8 sequence length by the top 5 bits of the lead byte (0 - not a lead byte)
+		const unsigned char Utf8Length[32] = {
+			1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+			0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 3, 3, 4, 0
+		};
+
+		const uint32_t ReplacementChar = 0xFFFD;
+
+		// Decodes the character at text[pos] and moves pos past it.
+		// Malformed sequences give U+FFFD and skip one byte
+		inline uint32_t NextCodepoint(const std::string& text, size_t& pos)
+		{
+			const unsigned char* s = (const unsigned char*)text.data() + pos;
+			const size_t left = text.length() - pos;
+
+			const unsigned int length = Utf8Length[s[0] >> 3];
+
+			if (length == 1)
+			{
+				++pos;
+				return s[0];
+			}
+
+			if (length == 0 || length > left)
+			{
+				++pos;
+				return ReplacementChar;
+			}
+
+			// Continuation bytes are 10xxxxxx
+			uint32_t codepoint = s[0] & (0x7F >> length);
+			unsigned int bad = 0;
+			for (unsigned int i = 1; i < length; ++i)
+			{
+				codepoint = (codepoint << 6) | (s[i] & 0x3F);
+				bad |= (s[i] & 0xC0) ^ 0x80;
+			}
+
+			// Overlong forms, surrogates and values past U+10FFFF are rejected
+			static const uint32_t minimum[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+			if (bad || codepoint < minimum[length] || codepoint > 0x10FFFF ||
+				(codepoint >= 0xD800 && codepoint <= 0xDFFF))
+			{
+				++pos;
+				return ReplacementChar;
+			}
+
+			pos += length;
+			return codepoint;
+		}
+
+		// Wide strings are UTF-16 where wchar_t has 16 bits (Windows), UTF-32 otherwise
+		inline uint32_t NextCodepoint(const std::wstring& text, size_t& pos)
+		{
+			const uint32_t c = (uint32_t)text[pos++];
+
+			if (sizeof(wchar_t) == 2 && c >= 0xD800 && c <= 0xDBFF && pos < text.length())
+			{
+				const uint32_t low = (uint32_t)text[pos];
+				if (low >= 0xDC00 && low <= 0xDFFF)
+				{
+					++pos;
+					return 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+				}
+			}
+
+			return c;
+		}
+
+		// Metrics of one pixel size
+		//
+		// Advances and kerning come from the font tables (FT_Get_Advance, FT_Get_Kerning)
+		// without rasterizing glyphs, and are used both for measuring and for drawing,
+		// so measured widths match the drawn text.
+		struct SizeMetrics
+		{
+			float ascent;
+			float descent;
+			float height;
+
+			std::unordered_map<FT_UInt, float> advances;
+			std::unordered_map<uint64_t, float> kerning;
+		};
+
+		// Per-face FreeType state kept by Font
+		struct FaceCache
+		{
+			SizeCache sizes;
+			GlyphIndexMap glyphs;
+			std::unordered_map<unsigned int, SizeMetrics> metrics;
+		};
+
+		SizeMetrics* GetSizeMetrics(FT_Face face, FaceCache& cache, unsigned int pixels)
+		{
+			auto it = cache.metrics.find(pixels);
+			if (it != cache.metrics.end())
+				return &it->second;
+
+			if (!ActivateSize(face, cache.sizes, pixels))
+				return nullptr;
+
+			const FT_Size_Metrics& size = face->size->metrics;
+
+			SizeMetrics& metrics = cache.metrics[pixels];
+			metrics.ascent = (float)(size.ascender >> 6);
+			metrics.descent = (float)(-size.descender >> 6);
+			metrics.height = (float)(size.height >> 6);
+			return &metrics;
+		}
+
+		// Whole pixels, like the pen advance of rendered glyphs (advance.x >> 6)
+		float GlyphAdvance(FT_Face face, FaceCache& cache, SizeMetrics& metrics, unsigned int pixels, FT_UInt glyph)
+		{
+			auto it = metrics.advances.find(glyph);
+			if (it != metrics.advances.end())
+				return it->second;
+
+			FT_Fixed advance = 0;
+			if (!ActivateSize(face, cache.sizes, pixels) ||
+				FT_Get_Advance(face, glyph, FT_LOAD_DEFAULT, &advance) != 0)
+			{
+				advance = 0;
+			}
+
+			// 16.16 fixed point
+			return metrics.advances[glyph] = (float)(advance >> 16);
+		}
+
+		float GlyphKerning(FT_Face face, FaceCache& cache, SizeMetrics& metrics, unsigned int pixels, FT_UInt left, FT_UInt right)
+		{
+			if (!FT_HAS_KERNING(face) || left == 0 || right == 0)
+				return 0.0f;
+
+			const uint64_t pair = ((uint64_t)left << 32) | right;
+
+			auto it = metrics.kerning.find(pair);
+			if (it != metrics.kerning.end())
+				return it->second;
+
+			FT_Vector delta = { 0, 0 };
+			if (!ActivateSize(face, cache.sizes, pixels) ||
+				FT_Get_Kerning(face, left, right, FT_KERNING_DEFAULT, &delta) != 0)
+			{
+				delta.x = 0;
+			}
+
+			return metrics.kerning[pair] = (float)(delta.x >> 6);
+		}
+
+		// Pen advance of the text, without rasterizing anything
+		template <typename CharT>
+		bool MeasureString(FT_Face face, FaceCache& cache, unsigned int pixels, const std::basic_string<CharT>& text, TextMetrics& result)
+		{
+			SizeMetrics* metrics = GetSizeMetrics(face, cache, pixels);
+			if (!metrics)
+				return false;
+
+			float pen_x = 0.0f;
+			FT_UInt previous = 0;
+
+			for (size_t n = 0; n < text.length(); )
+			{
+				const FT_UInt glyph = cache.glyphs.Find(face, NextCodepoint(text, n));
+
+				pen_x += GlyphKerning(face, cache, *metrics, pixels, previous, glyph);
+				pen_x += GlyphAdvance(face, cache, *metrics, pixels, glyph);
+
+				previous = glyph;
+			}
+
+			result.width = pen_x;
+			result.height = metrics->height;
+			result.ascent = metrics->ascent;
+			result.descent = metrics->descent;
+			return true;
+		}
+
+		// Positions the glyphs of the text, rasterizing the ones missing from the atlas
+		// (as distance fields if the flag is set in glyphSize).
+		// Returns false if the size can not be set
+		template <typename CharT>
+		bool LayoutString(FT_Face face, FaceCache& cache, unsigned int glyphSize, const std::basic_string<CharT>& text, TextLayout& layout)
+		{
+			const bool distanceField = (glyphSize & DistanceFieldFlag) != 0;
+			const unsigned int font_size = glyphSize & ~DistanceFieldFlag;
+
+			bool sizeSet = false;
+
+			SizeMetrics* metrics = GetSizeMetrics(face, cache, font_size);
+			if (!metrics)
+				return false;
+
+			float pen_x = 0.0f;
+			FT_UInt previous = 0;
+
+			std::vector<GlyphQuad>& quads = layout.quads;
+			quads.reserve(text.length());
+
+			for (size_t n = 0; n < text.length(); )
+			{
+				const uint32_t charcode = NextCodepoint(text, n);
+
+				const GlyphKey key = { face, glyphSize, cache.glyphs.Find(face, charcode) };
+
+				pen_x += GlyphKerning(face, cache, *metrics, font_size, previous, key.glyph);
+
+				const float advance = GlyphAdvance(face, cache, *metrics, font_size, key.glyph);
+				previous = key.glyph;
+
+				const GlyphInfo* glyph = g_GlyphAtlas.Find(key);
+				if (!glyph)
+				{
+					/* cache miss: rasterize the glyph and put it to the atlas */
+					if (!sizeSet)
+					{
+						if (!ActivateSize(face, cache.sizes, font_size))
+						{
+							return false;
+						}
+						sizeSet = true;
+					}
+
+					int error = distanceField ?
+						FT_Load_Glyph(face, key.glyph, FT_LOAD_DEFAULT) :
+						FT_Load_Glyph(face, key.glyph, FT_LOAD_RENDER);
+
+					if (!error && distanceField)
+					{
+						error = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_SDF);
+					}
+
+					if (error)
+					{
+						std::cerr << "FT2: error loading char '" << charcode << "' from font" << std::endl;
+						pen_x += advance;
+						continue;  /* ignore errors */
+					}
+
+					glyph = g_GlyphAtlas.Insert(key, face->glyph);
+					if (!glyph)
+					{
+						pen_x += advance;
+						continue;
+					}
+				}
+
+				if (glyph->width > 0 && glyph->height > 0)
+				{
+					GlyphQuad quad = { glyph, pen_x + glyph->left, (float)-glyph->top };
+					quads.push_back(quad);
+				}
+
+				/* increment pen position */
+				pen_x += advance;
+			}
+
+			layout.advance = pen_x;
+			return true;
+		}
+
+		// Draws the text at font_size. Distance field glyphs (baseSize != 0) are rasterized
+		// once at baseSize and scaled, their edges are restored with the alpha test
+		template <typename CharT>
+		void DrawString(FT_Face face, FaceCache& cache, unsigned int font_size, unsigned int baseSize, float pen_x, float pen_y, const std::basic_string<CharT>& text, unsigned long color)
+		{
+			const unsigned int glyphSize = baseSize ? (baseSize | DistanceFieldFlag) : font_size;
+			const float scale = baseSize ? (float)font_size / baseSize : 1.0f;
+
+			LayoutKey key;
+			key.face = face;
+			key.size = glyphSize;
+			key.text.assign((const char*)text.data(), text.length() * sizeof(CharT));
+			key.charSize = sizeof(CharT);
+
+			const TextLayout* layout = g_LayoutCache.Find(key);
+			if (!layout)
+			{
+				TextLayout newLayout;
+				if (!LayoutString(face, cache, glyphSize, text, newLayout))
+					return;
+
+				layout = g_LayoutCache.Insert(key, std::move(newLayout));
+			}
+
+			if (baseSize)
+			{
+				Batch::SetAlphaTest(DistanceFieldEdge);
+				DrawGlyphQuads(layout->quads, pen_x, pen_y, scale, color);
+				Batch::SetAlphaTest(0.0f);
+			}
+			else
+			{
+				DrawGlyphQuads(layout->quads, pen_x, pen_y, 1.0f, color);
+			}
+		}
+	}
+
 	void* Font::libhandle = nullptr;
 
 	bool Font::Init()
 	{
+		if (libhandle)
+			return true;
+
 		int error = FT_Init_FreeType((FT_Library*)&Font::libhandle);
 		if (error)
 		{
@@ -33,6 +867,8 @@ namespace Graph
 
 	Font::Font(const std::string& path)
 		: handle(nullptr)
+		, cache(nullptr)
+		, distanceFieldSize(0)
 	{
 		FT_Face face;
 
@@ -53,157 +889,119 @@ namespace Graph
 		
 		std::cout << path << ": Font loaded" << std::endl;
 		handle = (void*)face;
+		cache = new FaceCache();
+	}
+
+	Font::Font(const unsigned char* data, size_t size, const std::string& name)
+		: handle(nullptr)
+		, cache(nullptr)
+		, distanceFieldSize(0)
+	{
+		FT_Face face;
+
+		auto error = FT_New_Memory_Face((FT_Library)libhandle,
+			data,
+			(FT_Long)size,
+			0,
+			&face);
+		if (error == FT_Err_Unknown_File_Format)
+		{
+			std::cerr << name << ": font format is unsupported: " << error << std::endl;
+			throw std::runtime_error("font format is unsupported");
+		}
+		else if (error)
+		{
+			std::cerr << name << ": font open error: " << error << std::endl;
+			throw std::runtime_error("font open error");
+		}
+
+		std::cout << name << ": Font loaded from memory" << std::endl;
+		handle = (void*)face;
+		cache = new FaceCache();
 	}
 
 	Font::Font(Font&& other)
 	{
 		this->handle = other.handle;
+		this->cache = other.cache;
+		this->distanceFieldSize = other.distanceFieldSize;
 		other.handle = nullptr;
+		other.cache = nullptr;
 	}
 
 	Font::~Font()
 	{
 		if (handle)
 		{
+			if (g_CachesAlive)
+			{
+				g_GlyphAtlas.Forget(handle);
+				g_LayoutCache.Forget(handle);
+			}
+
+			// The face frees its FT_Size objects
 			FT_Done_Face((FT_Face)handle);
 		}
+
+		delete (FaceCache*)cache;
 	}
 
-	const void* Font::operator()() const
+	TextMetrics Font::Measure(unsigned int font_size, const std::string& text) const
 	{
-		return handle;
+		return MeasureText(font_size, text);
 	}
 
-	void DrawChar(FT_Bitmap* bitmap, float x, float y, unsigned long color)
+	TextMetrics Font::Measure(unsigned int font_size, const std::wstring& text) const
 	{
-		GLuint texture;
-
-		glGenTextures(1, &texture);             // Generate a texture
-		glBindTexture(GL_TEXTURE_2D, texture); // Bind that texture temporarily
+		return MeasureText(font_size, text);
+	}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	template <typename CharT>
+	TextMetrics Font::MeasureText(unsigned int font_size, const std::basic_string<CharT>& text) const
+	{
+		TextMetrics result = { 0.0f, 0.0f, 0.0f, 0.0f };
 
-		// Create the texture. We get the offsets from the image, then we use it with the image's
-		// pixel data to create it.
+		if (!handle || font_size == 0)
+			return result;
 
-		const unsigned char r = (unsigned char)color;
-		const unsigned char g = (unsigned char)(color >> 8);
-		const unsigned char b = (unsigned char)(color >> 16);
+		// Distance field text is laid out at the base size and scaled
+		const unsigned int pixels = distanceFieldSize ? distanceFieldSize : font_size;
 
-		const auto total_pixels = bitmap->width * bitmap->rows;
-		std::vector<unsigned char> pixels(total_pixels * 4);
-		for (size_t i = 0; i < total_pixels; ++i)
+		if (MeasureString((FT_Face)handle, *(FaceCache*)cache, pixels, text, result) && pixels != font_size)
 		{
-			pixels[4 * i + 0] = r;// -bitmap->buffer[i];
-			pixels[4 * i + 1] = g;// -bitmap->buffer[i];
-			pixels[4 * i + 2] = b;// -bitmap->buffer[i];
-			pixels[4 * i + 3] = bitmap->buffer[i];
+			const float scale = (float)font_size / pixels;
+			result.width *= scale;
+			result.height *= scale;
+			result.ascent *= scale;
+			result.descent *= scale;
 		}
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bitmap->width, bitmap->rows, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
-		//glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bitmap->width, bitmap->rows, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, bitmap->buffer);
-
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-		glPushMatrix();
-
-		glTranslatef(x, y, 0.0);
-		//glRotated(angle, 0.0, 0.0, -1.0);
-
-		glBegin(GL_POLYGON);
-
-		glColor4f(1.0, 1.0, 1.0, 1.0);
-
-		glTexCoord2f(0.0f, 0.0f);
-		glVertex2d(0.0, 0.0);
-
-
-		glTexCoord2f(1.0f, 0.0f);
-		glVertex2d(bitmap->width, 0.0);
-
-		glTexCoord2f(1.0f, 1.0f);
-		glVertex2d(bitmap->width, bitmap->rows);
-
-		glTexCoord2f(0.0f, 1.0f);
-		glVertex2d(0, bitmap->rows);
-
-		glEnd();
-
-		glPopMatrix();
-
-		glDisable(GL_BLEND);
-
-		glBindTexture(GL_TEXTURE_2D, 0);
+		return result;
 	}
 
-	void Font::DrawText(unsigned int font_size,  float pen_x, float pen_y, const std::string& text, unsigned long color) const
+	void Font::SetDistanceField(unsigned int baseSize)
 	{
-		const FT_Face face = (FT_Face)handle;
-
-		int error = 0;
-
-		error = FT_Set_Pixel_Sizes(
-			face,        /* handle to face object */
-			0,           /* pixel_width           */
-			font_size);  /* pixel_height          */
-		if (error)
-		{
-			std::cerr << "set pixel size error: " << error << std::endl;
-			return;
-		}
-
-		const FT_GlyphSlot  slot = face->glyph;
+		distanceFieldSize = baseSize;
+	}
 
-		for (int n = 0; n < text.length(); n++)
-		{
-			/* load glyph image into the slot (erase previous one) */
-			error = FT_Load_Char(face, text[n], FT_LOAD_RENDER);
-			if (error)
-			{
-				std::cerr << "FT2: error loading char '" << text[n] << "' from font" << std::endl;
-				continue;  /* ignore errors */
-			}
+	void Font::ReleaseGlyphCache()
+	{
+		g_LayoutCache.Clear();
+		g_GlyphAtlas.Release();
+	}
 
-			/* now, draw to our target surface */
-			DrawChar(&slot->bitmap,
-				pen_x + slot->bitmap_left,
-				pen_y - slot->bitmap_top,
-				color
-				);
+	const void* Font::operator()() const
+	{
+		return handle;
+	}
 
-			/* increment pen position */
-			pen_x += slot->advance.x >> 6;
-		}
+	void Font::DrawText(unsigned int font_size, float pen_x, float pen_y, const std::string& text, unsigned long color) const
+	{
+		DrawString((FT_Face)handle, *(FaceCache*)cache, font_size, distanceFieldSize, pen_x, pen_y, text, color);
 	}
 
 	void Font::DrawText(unsigned int font_size, float pen_x, float pen_y, const std::wstring& text, unsigned long color) const
 	{
-		const FT_Face face = (FT_Face)handle;
-
-		int error = 0;
-
-		const FT_GlyphSlot  slot = face->glyph;
-
-		for (int n = 0; n < text.length(); n++)
-		{
-			/* load glyph image into the slot (erase previous one) */
-			error = FT_Load_Char(face, text[n], FT_LOAD_RENDER);
-			if (error)
-			{
-				std::cerr << "FT2: error loading char '" << text[n] << "' from font" << std::endl;
-				continue;  /* ignore errors */
-			}
-
-			/* now, draw to our target surface */
-			DrawChar(&slot->bitmap,
-				pen_x + slot->bitmap_left,
-				pen_y - slot->bitmap_top,
-				color);
-
-			/* increment pen position */
-			pen_x += slot->advance.x >> 6;
-		}
+		DrawString((FT_Face)handle, *(FaceCache*)cache, font_size, distanceFieldSize, pen_x, pen_y, text, color);
 	}
 }
@@ -1,22 +1,42 @@
 #pragma once
+#include <cstddef>
 #include <string>
 
+// TextMetrics
+#include "glfwbgi.h"
+
 namespace Graph
 {
 	class Font
 	{
 	public:
 		Font(const std::string& path);
+
+		// Font file in memory (e.g. from a bundle), data must outlive the font
+		Font(const unsigned char* data, size_t size, const std::string& name);
 		Font(Font&&);
 		~Font();
 
 		const void* operator()() const;
 
+		// text is UTF-8
 		void DrawText(unsigned int font_size, float x, float y, const std::string& text, unsigned long color) const;
 		void DrawText(unsigned int font_size, float x, float y, const std::wstring& text, unsigned long color) const;
 
+		// Draws text from distance field glyphs rasterized once at baseSize pixels
+		// and scaled to any size (0 - plain bitmaps rasterized for every size)
+		void SetDistanceField(unsigned int baseSize);
+
+		// Measures the text drawn with DrawText at font_size without rasterizing glyphs
+		TextMetrics Measure(unsigned int font_size, const std::string& text) const;
+		TextMetrics Measure(unsigned int font_size, const std::wstring& text) const;
+
+		// Initializes FreeType once, later calls do nothing
 		static bool Init();
 
+		// Frees the glyph atlas textures (needs a current GL context)
+		static void ReleaseGlyphCache();
+
 	private:
 		Font() = delete;
 		Font(const Font&) = delete;
@@ -24,9 +44,20 @@ namespace Graph
 		Font& operator=(const Font&) = delete;
 		Font& operator=(Font&&) = delete;
 
+	private:
+		template <typename CharT>
+		TextMetrics MeasureText(unsigned int font_size, const std::basic_string<CharT>& text) const;
+
 	private:
 		void* handle;
 
+		// Per-face caches: FT_Size objects of the pixel sizes used with the font
+		// and glyph indices of the characters drawn
+		void* cache;
+
+		// Distance field base size (0 - bitmaps)
+		unsigned int distanceFieldSize;
+
 		static void* libhandle;
 	};
 
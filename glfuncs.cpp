@@ -0,0 +1,70 @@
+#include "glfuncs.h"
+
+#include <stdio.h>
+
+namespace Graph
+{
+namespace GLFuncs
+{
+	static bool g_Loaded = false;
+	static bool g_HasPixelBuffers = false;
+	static Buffers g_Buffers;
+
+	template <typename Func>
+	static bool LoadFunc(Func& func, const char* name)
+	{
+		func = (Func)glfwGetProcAddress(name);
+		return func != nullptr;
+	}
+
+	static bool ContextHasPixelBuffers()
+	{
+		int major = 0;
+		int minor = 0;
+
+		const char* version = (const char*)glGetString(GL_VERSION);
+		if (version && sscanf(version, "%d.%d", &major, &minor) == 2 &&
+			(major > 2 || (major == 2 && minor >= 1)))
+		{
+			return true;
+		}
+
+		return glfwExtensionSupported("GL_ARB_pixel_buffer_object") == GLFW_TRUE;
+	}
+
+	static void Load()
+	{
+		g_Loaded = true;
+
+		g_HasPixelBuffers = ContextHasPixelBuffers() &&
+			LoadFunc(g_Buffers.GenBuffers, "glGenBuffers") &&
+			LoadFunc(g_Buffers.DeleteBuffers, "glDeleteBuffers") &&
+			LoadFunc(g_Buffers.BindBuffer, "glBindBuffer") &&
+			LoadFunc(g_Buffers.BufferData, "glBufferData") &&
+			LoadFunc(g_Buffers.MapBuffer, "glMapBuffer") &&
+			LoadFunc(g_Buffers.UnmapBuffer, "glUnmapBuffer");
+
+		if (!g_HasPixelBuffers)
+		{
+			printf("Pixel buffer objects are not available, textures are updated directly\n");
+		}
+	}
+
+	const Buffers* PixelBuffers()
+	{
+		if (!g_Loaded)
+		{
+			Load();
+		}
+
+		return g_HasPixelBuffers ? &g_Buffers : nullptr;
+	}
+
+	void Reset()
+	{
+		g_Loaded = false;
+		g_HasPixelBuffers = false;
+	}
+
+} // namespace GLFuncs
+} // namespace Graph
@@ -0,0 +1,54 @@
+#pragma once
+
+#ifdef __APPLE__
+#define GL_SILENCE_DEPRECATION
+#include <GLFW/glfw3.h>
+#else
+#include "glfw\glfw3.h"
+#include <gl\GL.h>
+#endif
+
+#include <cstddef>
+
+// GL 1.5 / 2.1 constants missing from the Windows GL header
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+
+#ifdef _WIN32
+#define GRAPH_GLAPI __stdcall
+#else
+#define GRAPH_GLAPI
+#endif
+
+namespace Graph
+{
+	// GL entry points newer than GL 1.1, loaded at run time through GLFW
+	// (the Windows GL library exports only GL 1.1)
+	namespace GLFuncs
+	{
+		struct Buffers
+		{
+			void (GRAPH_GLAPI *GenBuffers)(GLsizei n, GLuint* buffers);
+			void (GRAPH_GLAPI *DeleteBuffers)(GLsizei n, const GLuint* buffers);
+			void (GRAPH_GLAPI *BindBuffer)(GLenum target, GLuint buffer);
+			void (GRAPH_GLAPI *BufferData)(GLenum target, ptrdiff_t size, const void* data, GLenum usage);
+			void* (GRAPH_GLAPI *MapBuffer)(GLenum target, GLenum access);
+			GLboolean (GRAPH_GLAPI *UnmapBuffer)(GLenum target);
+		};
+
+		// Buffer object functions if the context has pixel buffer objects
+		// (GL 2.1 or ARB_pixel_buffer_object), otherwise nullptr.
+		// Needs a current context, loaded on first use
+		const Buffers* PixelBuffers();
+
+		// Forgets the loaded functions (the context is destroyed)
+		void Reset();
+	}
+}
@@ -3,6 +3,14 @@
 #include "glfwbgi.h"
 
 #include "freetype.h"
+#include "batch.h"
+#include "packer.h"
+#include "threadpool.h"
+#include "mappedfile.h"
+#include "pixels.h"
+#include "imagecache.h"
+#include "bundle.h"
+#include "glfuncs.h"
 
 #ifdef __APPLE__
 #define GL_SILENCE_DEPRECATION
@@ -18,9 +26,16 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 
-#include <fstream>
+#include <string.h>
 #include <cstdint>
 #include <set>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <future>
 
 //#define DBG_OUT
 #ifdef DBG_OUT
@@ -52,7 +67,45 @@ static std::set<Mouse::IInputCallback* > g_MouseHandlers;
 static std::vector<GLFWcursor*> cursors;
 
 // Fonts
-static std::vector<Font> fonts;
+// Font registry
+//
+// Font files are mapped once and shared by every font created from them,
+// faces are created over the mapping with FT_New_Memory_Face.
+struct RegisteredFont
+{
+	// Declared before the font, so the font is destroyed first.
+	// Fonts from bundles keep the bundle mapped instead of the file
+	std::shared_ptr<MappedFile> file;
+	std::shared_ptr<const Bundle> bundle;
+	std::unique_ptr<Font> font;
+};
+
+static const unsigned char* FindBundleFile(const char * name, size_t * size, std::shared_ptr<const Bundle>& owner);
+
+static std::unordered_map<std::string, RegisteredFont> g_Fonts;
+static std::unordered_map<std::string, std::weak_ptr<MappedFile> > g_FontFiles;
+
+// Font used by OutText without a font name
+static Font* g_ActiveFont = nullptr;
+
+// Default font parsed in background, started by InitGraph
+struct DefaultFontLoad
+{
+	RegisteredFont entry;
+	double seconds;
+};
+
+static std::future<DefaultFontLoad> g_DefaultFontLoad;
+
+// Startup timing
+static StartupTiming g_StartupTiming = { 0, 0, 0, 0, 0, 0 };
+static std::chrono::steady_clock::time_point g_StartupBegin;
+static bool g_FirstFrameTimed = false;
+
+inline double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
 // Key buffer
 const unsigned long KeyBufSize = 32;
@@ -64,6 +117,10 @@ unsigned long bufWIndex = 0;
 // VKey buffer
 bool g_pressedKeys[GLFW_KEY_LAST];
 
+// Asynchronous image loads (defined with Image)
+void CancelImageLoads();
+void EnforceTextureBudget();
+
 //
 // Callbacks
 //
@@ -212,40 +269,238 @@ unsigned long GetColor(unsigned char r, unsigned char g, unsigned char b)
 // API
 //
 
-void InitFonts()
+// Maps the font file or takes the mapping already made for it
+static std::shared_ptr<MappedFile> MapFontFile(const char * filename)
 {
+	std::shared_ptr<MappedFile> file = g_FontFiles[filename].lock();
+	if (file)
+		return file;
+
+	file = std::make_shared<MappedFile>();
+	if (!file->Open(filename))
+		return nullptr;
+
+	g_FontFiles[filename] = file;
+	return file;
+}
+
 #ifdef __APPLE__
-	fonts.emplace_back("/Library/Fonts/Arial Unicode.ttf");
+static const char* DefaultFontPath = "/Library/Fonts/Arial Unicode.ttf";
 #else
-	fonts.emplace_back("c:\\windows\\fonts\\arial.ttf");
+static const char* DefaultFontPath = "c:\\windows\\fonts\\arial.ttf";
 #endif
+
+// Runs on a worker thread, touches nothing shared with the main thread
+// but the FreeType library, which the main thread doesn't use until the load is taken
+static DefaultFontLoad LoadDefaultFont()
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	DefaultFontLoad load;
+
+	if (!Font::Init())
+	{
+		printf("Font LIB init failed\n");
+	}
+	else
+	{
+		load.entry.file = std::make_shared<MappedFile>();
+		if (load.entry.file->Open(DefaultFontPath))
+		{
+			try
+			{
+				load.entry.font.reset(new Font(load.entry.file->Data(), load.entry.file->Size(), DefaultFontPath));
+			}
+			catch (const std::exception& e)
+			{
+				printf("Error. Default font [%s] is not loaded: %s\n", DefaultFontPath, e.what());
+			}
+		}
+	}
+
+	load.seconds = SecondsSince(start);
+	return load;
 }
 
-// Mouse cursor
-void InitCursors()
+// Takes the default font loaded in background, waiting for it if needed.
+// Called before any use of the registry
+static void FinishFontLoad()
+{
+	if (!g_DefaultFontLoad.valid())
+		return;
+
+	const auto start = std::chrono::steady_clock::now();
+	DefaultFontLoad load = g_DefaultFontLoad.get();
+	g_StartupTiming.fontWaitSeconds += SecondsSince(start);
+	g_StartupTiming.fontLoadSeconds = load.seconds;
+
+	if (!load.entry.font)
+		return;
+
+	g_FontFiles[DefaultFontPath] = load.entry.file;
+
+	Font* font = load.entry.font.get();
+	g_Fonts["default"] = std::move(load.entry);
+
+	if (!g_ActiveFont)
+		g_ActiveFont = font;
+}
+
+static Font* ActiveFont()
+{
+	FinishFontLoad();
+	return g_ActiveFont;
+}
+
+bool RegisterFont(const char * name, const char * filename)
+{
+	FinishFontLoad();
+
+	if (!Font::Init())
+	{
+		printf("Font LIB init failed\n");
+		return false;
+	}
+
+	if (g_Fonts.count(name))
+	{
+		printf("Error. Font [%s] is already registered\n", name);
+		return false;
+	}
+
+	RegisteredFont entry;
+
+	// Fonts in mounted bundles are used in place
+	size_t size = 0;
+	const unsigned char* data = FindBundleFile(filename, &size, entry.bundle);
+
+	if (!data)
+	{
+		entry.file = MapFontFile(filename);
+		if (!entry.file)
+			return false;
+
+		data = entry.file->Data();
+		size = entry.file->Size();
+	}
+
+	try
+	{
+		entry.font.reset(new Font(data, size, filename));
+	}
+	catch (const std::exception& e)
+	{
+		printf("Error. Font [%s] from [%s] is not loaded: %s\n", name, filename, e.what());
+		return false;
+	}
+
+	Font* font = entry.font.get();
+	g_Fonts[name] = std::move(entry);
+
+	if (!g_ActiveFont)
+		g_ActiveFont = font;
+
+	return true;
+}
+
+static Font* FindFont(const char * name)
+{
+	FinishFontLoad();
+
+	auto it = g_Fonts.find(name);
+	if (it == g_Fonts.end())
+	{
+		printf("Error. Font [%s] is not registered\n", name);
+		return nullptr;
+	}
+
+	return it->second.font.get();
+}
+
+bool SetFont(const char * name)
 {
-	cursors.resize((unsigned int)Mouse::CursorType::Last, nullptr);
+	Font* font = FindFont(name);
+	if (!font)
+		return false;
+
+	g_ActiveFont = font;
+	return true;
+}
+
+// Starts parsing the default font in background, text functions wait for it on first use.
+// It gets its own thread, so image loads queued on the shared pool don't delay it
+void InitFonts()
+{
+	if (g_Fonts.count("default") || g_DefaultFontLoad.valid())
+		return;
 
-	cursors[(unsigned int)Mouse::CursorType::Arrow] = glfwCreateStandardCursor(GLFW_ARROW_CURSOR);
-	cursors[(unsigned int)Mouse::CursorType::IBeam] = glfwCreateStandardCursor(GLFW_IBEAM_CURSOR);
-	cursors[(unsigned int)Mouse::CursorType::Crosshair] = glfwCreateStandardCursor(GLFW_CROSSHAIR_CURSOR);
-	cursors[(unsigned int)Mouse::CursorType::Hand] = glfwCreateStandardCursor(GLFW_POINTING_HAND_CURSOR);
-	cursors[(unsigned int)Mouse::CursorType::ResizeHorz] = glfwCreateStandardCursor(GLFW_RESIZE_EW_CURSOR);
-	cursors[(unsigned int)Mouse::CursorType::ResizeVert] = glfwCreateStandardCursor(GLFW_RESIZE_NS_CURSOR);
+	g_DefaultFontLoad = std::async(std::launch::async, &LoadDefaultFont);
+}
+
+// Mouse cursor
+//
+// Standard cursors are created on first use
+static int StandardCursorShape(unsigned int type)
+{
+	switch (type)
+	{
+	case Mouse::CursorType::Arrow:
+		return GLFW_ARROW_CURSOR;
+	case Mouse::CursorType::IBeam:
+		return GLFW_IBEAM_CURSOR;
+	case Mouse::CursorType::Crosshair:
+		return GLFW_CROSSHAIR_CURSOR;
+	case Mouse::CursorType::Hand:
+		return GLFW_POINTING_HAND_CURSOR;
+	case Mouse::CursorType::ResizeHorz:
+		return GLFW_RESIZE_EW_CURSOR;
+	case Mouse::CursorType::ResizeVert:
+		return GLFW_RESIZE_NS_CURSOR;
 #ifndef  __APPLE__
-	cursors[(unsigned int)Mouse::CursorType::ResizeDiag1] = glfwCreateStandardCursor(GLFW_RESIZE_NWSE_CURSOR);
-	cursors[(unsigned int)Mouse::CursorType::ResizeDiag2] = glfwCreateStandardCursor(GLFW_RESIZE_NESW_CURSOR);
+	case Mouse::CursorType::ResizeDiag1:
+		return GLFW_RESIZE_NWSE_CURSOR;
+	case Mouse::CursorType::ResizeDiag2:
+		return GLFW_RESIZE_NESW_CURSOR;
 #endif // ! __APPLE__
-	cursors[(unsigned int)Mouse::CursorType::ResizeAll] = glfwCreateStandardCursor(GLFW_RESIZE_ALL_CURSOR);
-	cursors[(unsigned int)Mouse::CursorType::NotAllowed] = glfwCreateStandardCursor(GLFW_NOT_ALLOWED_CURSOR);
+	case Mouse::CursorType::ResizeAll:
+		return GLFW_RESIZE_ALL_CURSOR;
+	case Mouse::CursorType::NotAllowed:
+		return GLFW_NOT_ALLOWED_CURSOR;
+	default:
+		return 0;
+	}
+}
+
+static GLFWcursor* GetCursor(unsigned int type)
+{
+	if (cursors.empty())
+	{
+		cursors.resize((unsigned int)Mouse::CursorType::Last, nullptr);
+	}
+
+	if (!cursors[type])
+	{
+		const int shape = StandardCursorShape(type);
+		if (shape)
+		{
+			cursors[type] = glfwCreateStandardCursor(shape);
+		}
+	}
+
+	return cursors[type];
 }
 
 void FreeCursors()
 {
 	for (auto pcurs : cursors)
 	{
-		glfwDestroyCursor(pcurs);
+		if (pcurs)
+		{
+			glfwDestroyCursor(pcurs);
+		}
 	}
+
+	cursors.clear();
 }
 
 bool InitGraph(int width, int height, const char * title)
@@ -258,6 +513,14 @@ bool InitGraph(int width, int height, const char * title)
 		return true;
 	}
 
+	g_StartupBegin = std::chrono::steady_clock::now();
+	g_FirstFrameTimed = false;
+
+	// Font parsing overlaps window creation
+	InitFonts();
+
+	auto stepStart = std::chrono::steady_clock::now();
+
 	int res = glfwInit();
 	if( res == GLFW_FALSE )
 	{
@@ -265,13 +528,9 @@ bool InitGraph(int width, int height, const char * title)
 		return false;
 	}
 
+	g_StartupTiming.glfwInitSeconds = SecondsSince(stepStart);
 	DBG_PRINT("GLFW initialized\n");
 
-	if (!Font::Init())
-	{
-		printf("Font LIB init failed\n");
-	}
-
 	//* Create a windowed mode window and its OpenGL context */
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
@@ -284,6 +543,8 @@ bool InitGraph(int width, int height, const char * title)
 	glfwWindowHint(GLFW_GREEN_BITS, 8);
 	glfwWindowHint(GLFW_BLUE_BITS, 8);
 
+	stepStart = std::chrono::steady_clock::now();
+
 	GLFWwindow * graphWindow = glfwCreateWindow(width, height, title, nullptr, nullptr);
 
 	if( graphWindow == nullptr )
@@ -305,6 +566,8 @@ bool InitGraph(int width, int height, const char * title)
 	//Make the window's context current */
 	glfwMakeContextCurrent(graphWindow);
 
+	g_StartupTiming.windowSeconds = SecondsSince(stepStart);
+
 	glfwSetKeyCallback(graphWindow, &MyKeyCallback);
 	glfwSetCharCallback(graphWindow, &MyCharCallback);
 	DBG_PRINT("key callbacks set\n");
@@ -318,12 +581,6 @@ bool InitGraph(int width, int height, const char * title)
 	glfwSetWindowSizeCallback(graphWindow, &MyResizeCallback);
 	DBG_PRINT("all callbacks set\n");
 
-	InitCursors();
-	DBG_PRINT("cursors created\n");
-
-	InitFonts();
-	DBG_PRINT("fonts created\n");
-
 	glMatrixMode(GL_PROJECTION);
 
 	glLoadIdentity();
@@ -331,7 +588,7 @@ bool InitGraph(int width, int height, const char * title)
 	glScalef(2 / ((float)width), -2 / ((float)height), 1);
 	glTranslatef(-((float)width - 2) / 2, -(float)height / 2, 0);
 
-	glLineWidth(1.5f);
+	Batch::SetLineWidth(1.5f);
 
 	glEnable(GL_TEXTURE);
 	glEnable(GL_TEXTURE_2D);
@@ -350,15 +607,44 @@ bool InitGraph(int width, int height, const char * title)
 	g_ScreenW = width;
 	g_ScreenH = height;
 
+	g_StartupTiming.initGraphSeconds = SecondsSince(g_StartupBegin);
+
 	return true;
 }
 
+StartupTiming GetStartupTiming()
+{
+	// Background load time is known once it's done, no need to wait for it
+	if (g_DefaultFontLoad.valid() &&
+		g_DefaultFontLoad.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		FinishFontLoad();
+	}
+
+	return g_StartupTiming;
+}
+
 void CloseGraph()
 {
+	Batch::Discard();
+
+	FinishFontLoad();
+
+	CancelImageLoads();
+
 	FreeCursors();
 
+	// Fonts are destroyed while the glyph caches and their bundles are still alive
+	g_ActiveFont = nullptr;
+	g_Fonts.clear();
+	g_FontFiles.clear();
+
+	Font::ReleaseGlyphCache();
+
 	glfwTerminate();
 
+	GLFuncs::Reset();
+
 	g_GraphWindow = nullptr;
 }
 
@@ -447,6 +733,48 @@ void Delay(long ms)
 	}
 }
 
+// Scratch buffer for shape vertices (x,y pairs)
+static std::vector<float> g_Shape;
+
+inline void AddShapePoint(float x, float y)
+{
+	g_Shape.push_back(x);
+	g_Shape.push_back(y);
+}
+
+// Records a line strip (or a closed loop) as separate line segments
+void Outline(const float * xy, unsigned int count, bool closed, unsigned long color)
+{
+	if (count < 2) return;
+
+	const unsigned int segments = closed ? count : count - 1;
+
+	Batch::Vertex* v = Batch::Append(Batch::Lines, 0, segments * 2);
+
+	for (unsigned int i = 0; i < segments; ++i)
+	{
+		const unsigned int next = (i + 1) % count;
+
+		Batch::Put(*v++, xy[2 * i], xy[2 * i + 1], color);
+		Batch::Put(*v++, xy[2 * next], xy[2 * next + 1], color);
+	}
+}
+
+// Records a convex polygon as a triangle fan around the first point
+void Fan(const float * xy, unsigned int count, unsigned long color)
+{
+	if (count < 3) return;
+
+	Batch::Vertex* v = Batch::Append(Batch::Triangles, 0, (count - 2) * 3);
+
+	for (unsigned int i = 1; i + 1 < count; ++i)
+	{
+		Batch::Put(*v++, xy[0], xy[1], color);
+		Batch::Put(*v++, xy[2 * i], xy[2 * i + 1], color);
+		Batch::Put(*v++, xy[2 * i + 2], xy[2 * i + 3], color);
+	}
+}
+
 void Rectangled(double x1, double y1, double x2, double y2, unsigned long color, bool bPolygon)
 {
 	if( !g_GraphEnabled ) return;
@@ -459,18 +787,123 @@ void Rectangled(double x1, double y1, double x2, double y2, unsigned long color,
 		return;
 	}
 
-	Color::Type &tmpColor = *((Color::Type*)&color);
+	if (bPolygon)
+	{
+		Batch::Vertex* v = Batch::Append(Batch::Quads, 0, 4);
+
+		Batch::Put(v[0], (float)x1, (float)y1, color);
+		Batch::Put(v[1], (float)x2, (float)y1, color);
+		Batch::Put(v[2], (float)x2, (float)y2, color);
+		Batch::Put(v[3], (float)x1, (float)y2, color);
+	}
+	else
+	{
+		const float xy[] = {
+			(float)x1, (float)y1,
+			(float)x2, (float)y1,
+			(float)x2, (float)y2,
+			(float)x1, (float)y2
+		};
+
+		Outline(xy, 4, true, color);
+	}
+}
+
+// Ellipse tessellation settings (see SetEllipseQuality)
+static double g_EllipseMaxError = 0.25;
+static unsigned int g_EllipseMinSegments = 12;
+static unsigned int g_EllipseMaxSegments = 1024;
+
+// Number of segments per full ellipse, memoized by rounded up radius
+static std::vector<unsigned short> g_SegmentsForRadius;
+
+// Number of segments for a full ellipse of the given radius,
+// chosen so that no chord deviates from the arc more than g_EllipseMaxError pixels
+unsigned int EllipseSegments(double radius)
+{
+	const size_t index = radius > 0 ? (size_t)ceil(radius) : 0;
+
+	if (index < g_SegmentsForRadius.size() && g_SegmentsForRadius[index] != 0)
+	{
+		return g_SegmentsForRadius[index];
+	}
+
+	// Tiny ellipses are within the error with any polygon
+	double segments = g_EllipseMinSegments;
+
+	if (index > 0)
+	{
+		// chord error of a segment with angle a is radius * (1 - cos(a/2))
+		const double halfAngleCos = 1 - g_EllipseMaxError / index;
+		if (halfAngleCos > -1)
+		{
+			const double maxAngle = 2 * acos(halfAngleCos);
+			segments = ceil(2 * M_PI / maxAngle);
+		}
+	}
+
+	if (segments < g_EllipseMinSegments) segments = g_EllipseMinSegments;
+	if (segments > g_EllipseMaxSegments) segments = g_EllipseMaxSegments;
+
+	if (index >= g_SegmentsForRadius.size())
+	{
+		g_SegmentsForRadius.resize(index + 1, 0);
+	}
+
+	g_SegmentsForRadius[index] = (unsigned short)segments;
+
+	return (unsigned int)segments;
+}
+
+struct UnitPoint
+{
+	float c;
+	float s;
+};
+
+// cos/sin of every whole degree, for exact arc end points
+static UnitPoint g_DegreeTable[360];
+static bool g_DegreeTableReady = false;
+
+const UnitPoint& DegreePoint(int degrees)
+{
+	if (!g_DegreeTableReady)
+	{
+		for (int i = 0; i < 360; ++i)
+		{
+			g_DegreeTable[i].c = (float)cos(i * M_PI / 180);
+			g_DegreeTable[i].s = (float)sin(i * M_PI / 180);
+		}
+		g_DegreeTableReady = true;
+	}
+
+	return g_DegreeTable[((degrees % 360) + 360) % 360];
+}
+
+// Unit circle vertex tables keyed by segment count
+static std::unordered_map<unsigned int, std::vector<UnitPoint> > g_CircleTables;
 
-	glBegin(bPolygon ? GL_POLYGON : GL_LINE_LOOP);
+const std::vector<UnitPoint>& CircleTable(unsigned int segments)
+{
+	std::vector<UnitPoint>& table = g_CircleTables[segments];
 
-	glColor3ub(tmpColor.rgb.r, tmpColor.rgb.g, tmpColor.rgb.b);
+	if (table.empty())
+	{
+		table.resize(segments);
+		for (unsigned int i = 0; i < segments; ++i)
+		{
+			table[i].c = (float)cos(2 * M_PI * i / segments);
+			table[i].s = (float)sin(2 * M_PI * i / segments);
+		}
+	}
 
-	glVertex2d(x1, y1);
-	glVertex2d(x2, y1);
-	glVertex2d(x2, y2);
-	glVertex2d(x1, y2);
+	return table;
+}
 
-	glEnd();
+// Floor of a / b for b > 0
+inline int FloorDiv(int a, int b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
 }
 
 enum EllipseType
@@ -480,45 +913,62 @@ enum EllipseType
 	Chord = 3
 };
 
-void Ellipsed(double x, double y, double xradius, double yradius, double startAngle, double stopAngle, unsigned long color, bool bPolygon, EllipseType type)
+// Angles are in degrees
+void Ellipsed(double x, double y, double xradius, double yradius, int startAngle, int stopAngle, unsigned long color, bool bPolygon, EllipseType type)
 {
 	if( !g_GraphEnabled ) return;
 
-	DBG_PRINT("Ellipsed %.1f %.1f %.1f %.1f %.1f %.1f %08lX %d %d\n", x, y, xradius, yradius, startAngle, stopAngle, color, bPolygon ? 1 : 0, (int)type);
+	DBG_PRINT("Ellipsed %.1f %.1f %.1f %.1f %d %d %08lX %d %d\n", x, y, xradius, yradius, startAngle, stopAngle, color, bPolygon ? 1 : 0, (int)type);
 
-	double fistep;
-	if( xradius > yradius )
+	g_Shape.clear();
+
+	if( type == EllipseType::Sector )
 	{
-		fistep = 1 / xradius;
+		AddShapePoint(x, y);
 	}
-	else
+
+	const float cx = (float)x;
+	const float cy = (float)y;
+	const float rx = (float)xradius;
+	const float ry = (float)yradius;
+
+	if (stopAngle > startAngle)
 	{
-		fistep = 1 / yradius;
-	}
+		// The arc is a slice of the cached unit circle (vertex k is at k * 360 / segments degrees)
+		// between the exact end points
+		const int segments = (int)EllipseSegments(xradius > yradius ? xradius : yradius);
+		const std::vector<UnitPoint>& circle = CircleTable(segments);
 
-	Color::Type &tmpColor = *((Color::Type*)&color);
+		const UnitPoint& first = DegreePoint(startAngle);
+		AddShapePoint(cx + rx*first.c, cy - ry*first.s);
 
-	glBegin(bPolygon ?
-		GL_POLYGON :
-		type == EllipseType::Arc ? GL_LINE_STRIP : GL_LINE_LOOP);
+		const int kFirst = FloorDiv(startAngle * segments, 360) + 1;
+		const int kLast = -FloorDiv(-stopAngle * segments, 360) - 1;
 
-	glColor3ub(tmpColor.rgb.r, tmpColor.rgb.g, tmpColor.rgb.b);
+		int index = ((kFirst % segments) + segments) % segments;
 
-	if( type == EllipseType::Sector )
-	{
-		glVertex2d(x, y);
-	}
+		for (int k = kFirst; k <= kLast; ++k)
+		{
+			const UnitPoint& p = circle[index];
+			AddShapePoint(cx + rx*p.c, cy - ry*p.s);
 
-	double fi = startAngle;
-	while (fi < stopAngle)
-	{
-		glVertex2d(x + xradius*cos(fi), y - yradius*sin(fi));
-		fi += fistep;
+			if (++index == segments) index = 0;
+		}
 	}
 
-	glVertex2d(x + xradius*cos(stopAngle), y-yradius*sin(stopAngle));
+	const UnitPoint& last = DegreePoint(stopAngle);
+	AddShapePoint(cx + rx*last.c, cy - ry*last.s);
 
-	glEnd();
+	const unsigned int count = (unsigned int)g_Shape.size() / 2;
+
+	if (bPolygon)
+	{
+		Fan(g_Shape.data(), count, color);
+	}
+	else
+	{
+		Outline(g_Shape.data(), count, type != EllipseType::Arc, color);
+	}
 }
 
 enum PolyType
@@ -534,31 +984,27 @@ void Poly(Point * points, unsigned short count, unsigned long color, PolyType ty
 
 	DBG_PRINT("Poly 0x%p %u %08lX %d\n", points, count, color, (int)type);
 
+	g_Shape.clear();
+
+	for (unsigned short i = 0 ; i < count ;++i)
+	{
+		AddShapePoint(points[i].x, points[i].y);
+	}
+
 	switch( type )
 	{
 	case Graph::ptLine:
-		glBegin(GL_LINE_STRIP);
+		Outline(g_Shape.data(), count, false, color);
 		break;
 	case Graph::ptLoop:
-		glBegin(GL_LINE_LOOP);
+		Outline(g_Shape.data(), count, true, color);
 		break;
 	case Graph::ptPolygon:
-		glBegin(GL_POLYGON);
+		Fan(g_Shape.data(), count, color);
 		break;
 	default:
 		return;
 	}
-
-	Color::Type &tmpColor = *((Color::Type*)&color);
-
-	glColor3ub(tmpColor.rgb.r, tmpColor.rgb.g, tmpColor.rgb.b);
-
-	for (unsigned short i = 0 ; i < count ;++i)
-	{
-		glVertex2i(points[i].x, points[i].y);
-	}
-
-	glEnd();
 }
 
 void Lined(double x1, double y1, double x2, double y2, unsigned long color)
@@ -567,16 +1013,10 @@ void Lined(double x1, double y1, double x2, double y2, unsigned long color)
 
 	DBG_PRINT("Line %.1f %.1f %.1f %.1f %08lX\n", x1, y1, x2, y2, color);
 
-	glBegin(GL_LINE_LOOP);
-	
-	Color::Type &tmpColor = *((Color::Type*)&color);
-
-	glColor3ub(tmpColor.rgb.r, tmpColor.rgb.g, tmpColor.rgb.b);
+	Batch::Vertex* v = Batch::Append(Batch::Lines, 0, 2);
 
-	glVertex2d(x1, y1);
-	glVertex2d(x2, y2);
-
-	glEnd();
+	Batch::Put(v[0], (float)x1, (float)y1, color);
+	Batch::Put(v[1], (float)x2, (float)y2, color);
 }
 
 void DrawLine(short x1, short y1, short x2, short y2, unsigned long color)
@@ -586,17 +1026,17 @@ void DrawLine(short x1, short y1, short x2, short y2, unsigned long color)
 
 void DrawEllipseArc(short x, short y, unsigned short xradius, unsigned short yradius, short startAngle, short stopAngle, unsigned long color)
 {
-	Ellipsed(x, y, xradius, yradius, startAngle * M_PI / 180, stopAngle * M_PI / 180, color, false, EllipseType::Arc);
+	Ellipsed(x, y, xradius, yradius, startAngle, stopAngle, color, false, EllipseType::Arc);
 }
 
 void DrawEllipseSector(short x, short y, unsigned short xradius, unsigned short yradius, short startAngle, short stopAngle, unsigned long color)
 {
-	Ellipsed(x, y, xradius, yradius, startAngle * M_PI / 180, stopAngle * M_PI / 180, color, false, EllipseType::Sector);
+	Ellipsed(x, y, xradius, yradius, startAngle, stopAngle, color, false, EllipseType::Sector);
 }
 
 void DrawEllipseChord(short x, short y, unsigned short xradius, unsigned short yradius, short startAngle, short stopAngle, unsigned long color)
 {
-	Ellipsed(x, y, xradius, yradius, startAngle * M_PI / 180, stopAngle * M_PI / 180, color, false, EllipseType::Chord);
+	Ellipsed(x, y, xradius, yradius, startAngle, stopAngle, color, false, EllipseType::Chord);
 }
 
 void DrawPoly(Point * points, unsigned short count, unsigned long color)
@@ -611,12 +1051,12 @@ void DrawPolyLine(Point * points, unsigned short count, unsigned long color)
 
 void FillEllipseSector(short x, short y, unsigned short xradius, unsigned short yradius, short startAngle, short stopAngle, unsigned long color)
 {
-	Ellipsed(x, y, xradius, yradius, startAngle * M_PI / 180, stopAngle * M_PI / 180, color, true, EllipseType::Sector);
+	Ellipsed(x, y, xradius, yradius, startAngle, stopAngle, color, true, EllipseType::Sector);
 }
 
 void FillEllipseChord(short x, short y, unsigned short xradius, unsigned short yradius, short startAngle, short stopAngle, unsigned long color)
 {
-	Ellipsed(x, y, xradius, yradius, startAngle * M_PI / 180, stopAngle * M_PI / 180, color, true, EllipseType::Chord);
+	Ellipsed(x, y, xradius, yradius, startAngle, stopAngle, color, true, EllipseType::Chord);
 }
 
 void DrawRectangle(short x1, short y1, short x2, short y2, unsigned long color)
@@ -635,29 +1075,172 @@ void SetLineWidth(float thickness)
 
 	if( thickness <= 0 ) return;
 
-	glLineWidth(thickness);
+	Batch::SetLineWidth(thickness);
 }
 
 
+void SetEllipseQuality(float maxError, unsigned short minSegments, unsigned short maxSegments)
+{
+	if( maxError <= 0 ) return;
+
+	if( minSegments < 3 ) minSegments = 3;
+	if( maxSegments < minSegments ) maxSegments = minSegments;
+
+	g_EllipseMaxError = maxError;
+	g_EllipseMinSegments = minSegments;
+	g_EllipseMaxSegments = maxSegments;
+
+	g_SegmentsForRadius.clear();
+}
+
 void FillRectangle(short x1, short y1, short x2, short y2, unsigned long color)
 {
 	Rectangled(x1, y1, x2, y2, color, true);
 }
 
-void ClearDevice(unsigned long color)
+void FillRectangles(const RectItem * rects, unsigned int count)
 {
 	if( !g_GraphEnabled ) return;
 
-	Color::Type tmpColor;
-	tmpColor.dwColor = color;
+	DBG_PRINT("FillRectangles 0x%p %u\n", rects, count);
 
-	glClearColor(
-		tmpColor.rgb.r / 255.0f,
+	// Rectangles are appended in chunks the recorder holds at once
+	const unsigned int chunk = Batch::MaxVertices / 4;
+
+	for (unsigned int first = 0; first < count; )
+	{
+		const unsigned int end = first + std::min(count - first, chunk);
+
+		unsigned int valid = 0;
+		for (unsigned int i = first; i < end; ++i)
+		{
+			if (rects[i].x2 >= rects[i].x1 && rects[i].y2 >= rects[i].y1) ++valid;
+		}
+
+		if (valid != 0)
+		{
+			Batch::Vertex* v = Batch::Append(Batch::Quads, 0, valid * 4);
+
+			for (unsigned int i = first; i < end; ++i)
+			{
+				const RectItem& r = rects[i];
+				if (r.x2 < r.x1 || r.y2 < r.y1) continue;
+
+				Batch::Put(*v++, r.x1, r.y1, r.color);
+				Batch::Put(*v++, r.x2, r.y1, r.color);
+				Batch::Put(*v++, r.x2, r.y2, r.color);
+				Batch::Put(*v++, r.x1, r.y2, r.color);
+			}
+		}
+
+		first = end;
+	}
+}
+
+void DrawLines(const LineItem * lines, unsigned int count)
+{
+	if( !g_GraphEnabled ) return;
+
+	DBG_PRINT("DrawLines 0x%p %u\n", lines, count);
+
+	// Lines are appended in chunks the recorder holds at once
+	const unsigned int chunk = Batch::MaxVertices / 2;
+
+	for (unsigned int first = 0; first < count; )
+	{
+		const unsigned int end = first + std::min(count - first, chunk);
+
+		Batch::Vertex* v = Batch::Append(Batch::Lines, 0, (end - first) * 2);
+
+		for (unsigned int i = first; i < end; ++i)
+		{
+			const LineItem& l = lines[i];
+
+			Batch::Put(*v++, l.x1, l.y1, l.color);
+			Batch::Put(*v++, l.x2, l.y2, l.color);
+		}
+
+		first = end;
+	}
+}
+
+void FillEllipses(const EllipseItem * ellipses, unsigned int count)
+{
+	if( !g_GraphEnabled ) return;
+
+	DBG_PRINT("FillEllipses 0x%p %u\n", ellipses, count);
+
+	unsigned int i = 0;
+
+	while (i < count)
+	{
+		// Ellipses are appended in chunks the recorder holds at once
+		size_t total = 0;
+		unsigned int end = i;
+
+		for (; end < count; ++end)
+		{
+			const EllipseItem& e = ellipses[end];
+			const size_t vertices = EllipseSegments(e.xradius > e.yradius ? e.xradius : e.yradius) * 3;
+
+			if (total + vertices > Batch::MaxVertices && total != 0)
+				break;
+
+			total += vertices;
+		}
+
+		Batch::Vertex* v = Batch::Append(Batch::Triangles, 0, (unsigned int)total);
+
+		for (; i < end; ++i)
+		{
+			const EllipseItem& e = ellipses[i];
+
+			const unsigned int segments = EllipseSegments(e.xradius > e.yradius ? e.xradius : e.yradius);
+			const std::vector<UnitPoint>& circle = CircleTable(segments);
+
+			const float cx = e.x;
+			const float cy = e.y;
+			const float rx = e.xradius;
+			const float ry = e.yradius;
+
+			float px = cx + rx;
+			float py = cy;
+
+			for (unsigned int k = 1; k <= segments; ++k)
+			{
+				const UnitPoint& p = circle[k == segments ? 0 : k];
+
+				const float nx = cx + rx*p.c;
+				const float ny = cy - ry*p.s;
+
+				Batch::Put(*v++, cx, cy, e.color);
+				Batch::Put(*v++, px, py, e.color);
+				Batch::Put(*v++, nx, ny, e.color);
+
+				px = nx;
+				py = ny;
+			}
+		}
+	}
+}
+
+void ClearDevice(unsigned long color)
+{
+	if( !g_GraphEnabled ) return;
+
+	Color::Type tmpColor;
+	tmpColor.dwColor = color;
+
+	glClearColor(
+		tmpColor.rgb.r / 255.0f,
 		tmpColor.rgb.g / 255.0f,
 		tmpColor.rgb.b / 255.0f,
 		1.0
 	);
 
+	// Everything recorded so far would be cleared anyway
+	Batch::Discard();
+
 	glClear(GL_COLOR_BUFFER_BIT);
 }
 
@@ -665,10 +1248,22 @@ void SwapBuffers()
 {
 	if( !g_GraphEnabled ) return;
 
+	Batch::Flush();
+
+	// Textures not drawn for a while are dropped when over the budget
+	EnforceTextureBudget();
+
 	glfwSwapBuffers(g_GraphWindow);
-}
 
-#define ang( a ) a * M_PI / 180
+	if (!g_FirstFrameTimed)
+	{
+		g_StartupTiming.firstFrameSeconds = SecondsSince(g_StartupBegin);
+		g_FirstFrameTimed = true;
+	}
+
+	// Textures decoded in background are created for the next frame
+	PumpImageLoads();
+}
 
 double FontWidth = 4;
 double FontHeight = 8;
@@ -698,22 +1293,22 @@ void UpperB(double x, double y)
 
 	Lined(x, y, x, y- FontHeight, FontColor);
 
-	Ellipsed(x, y - FontHeight + yradius, xradius, yradius,ang( 0),ang( 90), FontColor, false, EllipseType::Arc);
-	Ellipsed(x, y - FontHeight + yradius, xradius, yradius,ang( 270),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x, y - FontHeight + yradius, xradius, yradius,0,90, FontColor, false, EllipseType::Arc);
+	Ellipsed(x, y - FontHeight + yradius, xradius, yradius,270,360, FontColor, false, EllipseType::Arc);
 
-	Ellipsed(x, y - yradius, FontWidth, yradius,ang( 0),ang( 90), FontColor, false, EllipseType::Arc);
-	Ellipsed(x, y - yradius, FontWidth, yradius,ang( 270),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x, y - yradius, FontWidth, yradius,0,90, FontColor, false, EllipseType::Arc);
+	Ellipsed(x, y - yradius, FontWidth, yradius,270,360, FontColor, false, EllipseType::Arc);
 }
 
 void UpperC(double x, double y)
 {
-	Ellipsed(x+FontWidth / 2, y-FontHeight/2, FontWidth / 2, FontHeight / 2,ang( 50),ang( 310), FontColor, false, EllipseType::Arc);
+	Ellipsed(x+FontWidth / 2, y-FontHeight/2, FontWidth / 2, FontHeight / 2,50,310, FontColor, false, EllipseType::Arc);
 }
 
 void UpperD(double x, double y)
 {
-	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontHeight / 2,ang( 0),ang( 90), FontColor, false, EllipseType::Arc);
-	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontHeight / 2,ang( 270),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontHeight / 2,0,90, FontColor, false, EllipseType::Arc);
+	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontHeight / 2,270,360, FontColor, false, EllipseType::Arc);
 	
 	Lined(x+FontWidth / 2, y,x,y, FontColor);
 
@@ -739,7 +1334,7 @@ void UpperF(double x, double y)
 
 void UpperG(double x, double y)
 {
-	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontHeight / 2,ang( 50),ang( 270), FontColor, false, EllipseType::Arc);
+	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontHeight / 2,50,270, FontColor, false, EllipseType::Arc);
 	
 	Lined(x + FontWidth / 2, y,x + FontWidth, y, FontColor);
 	Lined(x + FontWidth, y,x + FontWidth, y-FontHeight / 3, FontColor);
@@ -768,7 +1363,7 @@ void UpperJ(double x, double y)
 	Lined(x+FontWidth, y-FontHeight, x+FontWidth / 2, y-FontHeight, FontColor);
 	Lined(x+FontWidth, y-FontHeight, x+FontWidth, y-FontWidth / 2, FontColor);
 
-	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontWidth / 2,ang( 180),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontWidth / 2,180,360, FontColor, false, EllipseType::Arc);
 }
 
 void UpperK(double x, double y)
@@ -801,7 +1396,7 @@ void UpperN(double x, double y)
 
 void UpperO(double x, double y)
 {
-	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontHeight / 2,ang( 0),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontHeight / 2,0,360, FontColor, false, EllipseType::Arc);
 }
 
 void UpperP(double x, double y)
@@ -811,13 +1406,13 @@ void UpperP(double x, double y)
 	h3 = FontHeight/3;
 
 	Lined(x,y,x,y-FontHeight, FontColor);
-	Ellipsed(x, y - FontHeight + h3, FontWidth, h3,ang( 0),ang( 90), FontColor, false, EllipseType::Arc);
-	Ellipsed(x, y - FontHeight + h3, FontWidth, h3,ang( 270),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x, y - FontHeight + h3, FontWidth, h3,0,90, FontColor, false, EllipseType::Arc);
+	Ellipsed(x, y - FontHeight + h3, FontWidth, h3,270,360, FontColor, false, EllipseType::Arc);
 }
 
 void UpperQ(double x, double y)
 {	
-	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontHeight / 2,ang( 0),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x+FontWidth / 2, y-FontHeight / 2, FontWidth / 2, FontHeight / 2,0,360, FontColor, false, EllipseType::Arc);
 	Lined(x+FontWidth / 2, y-FontHeight / 4, x+FontWidth, y+FontHeight / 4, FontColor);
 }
 
@@ -828,8 +1423,8 @@ void UpperR(double x, double y)
 	h3 = (FontHeight/4);
 
 	Lined(x,y,x,y-FontHeight, FontColor);
-	Ellipsed(x, y - FontHeight + h3, FontWidth, h3,ang( 0),ang( 90), FontColor, false, EllipseType::Arc);
-	Ellipsed(x, y - FontHeight + h3, FontWidth, h3,ang( 270),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x, y - FontHeight + h3, FontWidth, h3,0,90, FontColor, false, EllipseType::Arc);
+	Ellipsed(x, y - FontHeight + h3, FontWidth, h3,270,360, FontColor, false, EllipseType::Arc);
 
 	Lined(x, y - FontHeight + 2*h3, x + FontWidth, y, FontColor);
 }
@@ -842,9 +1437,9 @@ void UpperS(double x, double y)
 	xradius = FontWidth / 2;
 	yradius = FontHeight / 4;
 
-	Ellipsed(x + xradius, y - FontHeight + yradius, xradius, yradius,ang( 30),ang( 280), FontColor, false, EllipseType::Arc);
-	Ellipsed(x + xradius, y - yradius, xradius, yradius,ang( 0),ang( 100), FontColor, false, EllipseType::Arc);
-	Ellipsed(x + xradius, y - yradius, xradius, yradius,ang( 210),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x + xradius, y - FontHeight + yradius, xradius, yradius,30,280, FontColor, false, EllipseType::Arc);
+	Ellipsed(x + xradius, y - yradius, xradius, yradius,0,100, FontColor, false, EllipseType::Arc);
+	Ellipsed(x + xradius, y - yradius, xradius, yradius,210,360, FontColor, false, EllipseType::Arc);
 }
 
 void UpperT(double x, double y)
@@ -859,7 +1454,7 @@ void UpperU(double x, double y)
 	Lined(x, y-FontHeight, x, y-FontWidth / 2, FontColor);
 	Lined(x+FontWidth, y-FontHeight, x+FontWidth, y-FontWidth / 2, FontColor);
 
-	Ellipsed(x+FontWidth / 2, y - FontWidth / 2, FontWidth / 2, FontWidth / 2,ang( 180),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x+FontWidth / 2, y - FontWidth / 2, FontWidth / 2, FontWidth / 2,180,360, FontColor, false, EllipseType::Arc);
 }
 
 
@@ -923,7 +1518,7 @@ void Symbol2(double x, double y)
 
 	yradius = FontHeight / 4;
 
-	Ellipsed(x + FontWidth - FontWidth / 2, y - FontHeight + yradius, FontWidth / 2, yradius,ang( 0),ang( 180), FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth - FontWidth / 2, y - FontHeight + yradius, FontWidth / 2, yradius,0,180, FontColor, false, EllipseType::Arc);
 
 	Lined(x + FontWidth, y - FontHeight + yradius,x,y, FontColor);
 	Lined(x,y,x+FontWidth,y, FontColor);
@@ -934,11 +1529,11 @@ void Symbol3(double x, double y)
 	double yradius;
 
 	yradius = FontHeight / 4;
-	Ellipsed(x + FontWidth / 2, y - FontHeight + yradius, FontWidth / 2, yradius,ang( 0),ang( 120), FontColor, false, EllipseType::Arc);
-	Ellipsed(x + FontWidth / 2, y - FontHeight + yradius, FontWidth / 2, yradius,ang( 260),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth / 2, y - FontHeight + yradius, FontWidth / 2, yradius,0,120, FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth / 2, y - FontHeight + yradius, FontWidth / 2, yradius,260,360, FontColor, false, EllipseType::Arc);
 
-	Ellipsed(x + FontWidth / 2, y - yradius, FontWidth / 2, yradius,ang( 0),ang( 100), FontColor, false, EllipseType::Arc);
-	Ellipsed(x + FontWidth / 2, y - yradius, FontWidth / 2, yradius,ang( 240),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth / 2, y - yradius, FontWidth / 2, yradius,0,100, FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth / 2, y - yradius, FontWidth / 2, yradius,240,360, FontColor, false, EllipseType::Arc);
 }
 
 void Symbol4(double x, double y)
@@ -954,8 +1549,8 @@ void Symbol5(double x, double y)
 
 	yradius = (FontHeight + 3) / 4;
 
-	Ellipsed(x, y - yradius, FontWidth, yradius,ang( 0),ang( 90), FontColor, false, EllipseType::Arc);
-	Ellipsed(x, y - yradius, FontWidth, yradius,ang( 270),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x, y - yradius, FontWidth, yradius,0,90, FontColor, false, EllipseType::Arc);
+	Ellipsed(x, y - yradius, FontWidth, yradius,270,360, FontColor, false, EllipseType::Arc);
 
 	Lined(x, y - 2*yradius,x, y - FontHeight, FontColor);
 	Lined(x, y - FontHeight,x + FontWidth, y - FontHeight, FontColor);
@@ -966,8 +1561,8 @@ void Symbol6(double x, double y)
 	double yradius;
 
 	yradius = FontHeight / 4;
-	Ellipsed(x + FontWidth / 2, y - FontHeight / 2, FontWidth / 2, FontHeight / 2,ang( 90),ang( 270), FontColor, false, EllipseType::Arc);
-	Ellipsed(x + FontWidth / 2, y - yradius, FontWidth / 2, yradius,ang( 0),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth / 2, y - FontHeight / 2, FontWidth / 2, FontHeight / 2,90,270, FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth / 2, y - yradius, FontWidth / 2, yradius,0,360, FontColor, false, EllipseType::Arc);
 }
 
 void Symbol7(double x, double y)
@@ -981,8 +1576,8 @@ void Symbol8(double x, double y)
 	double yradius;
 
 	yradius = FontHeight / 4;
-	Ellipsed(x + FontWidth / 2, y - FontHeight + yradius, FontWidth / 2, yradius,ang( 0),ang( 360), FontColor, false, EllipseType::Arc);
-	Ellipsed(x + FontWidth / 2, y - yradius, FontWidth / 2, yradius,ang( 0),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth / 2, y - FontHeight + yradius, FontWidth / 2, yradius,0,360, FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth / 2, y - yradius, FontWidth / 2, yradius,0,360, FontColor, false, EllipseType::Arc);
 }
 
 void Symbol9(double x, double y)
@@ -991,10 +1586,10 @@ void Symbol9(double x, double y)
 
 	yradius = FontHeight / 4;
 
-	Ellipsed(x + FontWidth / 2, y - FontHeight / 2, FontWidth / 2, FontHeight / 2,ang( 0),ang( 90), FontColor, false, EllipseType::Arc);
-	Ellipsed(x + FontWidth / 2, y - FontHeight / 2, FontWidth / 2, FontHeight / 2,ang( 270),ang( 360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth / 2, y - FontHeight / 2, FontWidth / 2, FontHeight / 2,0,90, FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth / 2, y - FontHeight / 2, FontWidth / 2, FontHeight / 2,270,360, FontColor, false, EllipseType::Arc);
 	
-	Ellipsed(x + FontWidth / 2, y - FontHeight + yradius, FontWidth / 2, yradius, ang(0), ang(360), FontColor, false, EllipseType::Arc);
+	Ellipsed(x + FontWidth / 2, y - FontHeight + yradius, FontWidth / 2, yradius, 0, 360, FontColor, false, EllipseType::Arc);
 }
 
 void OutChar(double x, double y, char ch)
@@ -1043,6 +1638,46 @@ void OutChar(double x, double y, char ch)
 		}
 }
 
+TextMetrics MeasureText(const std::wstring& text, unsigned short size, const char * font)
+{
+	Font* f = font ? FindFont(font) : ActiveFont();
+	if (f)
+	{
+		return f->Measure(size, text);
+	}
+
+	// Fall-back font, see OutText
+	TextMetrics metrics = { (float)text.length() * (size / 2.0f + size / 4.0f), (float)size, (float)size, 0.0f };
+	return metrics;
+}
+
+TextMetrics MeasureText(const std::string& text, unsigned short size, const char * font)
+{
+	Font* f = font ? FindFont(font) : ActiveFont();
+	if (f)
+	{
+		return f->Measure(size, text);
+	}
+
+	TextMetrics metrics = { (float)text.length() * (size / 2.0f + size / 4.0f), (float)size, (float)size, 0.0f };
+	return metrics;
+}
+
+TextMetrics MeasureText(const char * text, unsigned short size, const char * font)
+{
+	return MeasureText(std::string(text), size, font);
+}
+
+void SetTextDistanceField(bool enable, unsigned short baseSize)
+{
+	FinishFontLoad();
+
+	for (auto& font : g_Fonts)
+	{
+		font.second.font->SetDistanceField(enable ? baseSize : 0);
+	}
+}
+
 void OutText(short startx, short starty, char text, unsigned long color, unsigned short size)
 {
 	std::string tmp(1, text);
@@ -1051,16 +1686,39 @@ void OutText(short startx, short starty, char text, unsigned long color, unsigne
 
 void OutText(short startx, short starty, const std::wstring& text, unsigned long color, unsigned short size)
 {
-	if (!fonts.empty())
+	if (Font* font = ActiveFont())
 	{
 		// Freetype font
-		fonts.front().DrawText(size, startx, starty, text, color);
+		font->DrawText(size, startx, starty, text, color);
 		return;
 	}
 	
 	printf("No fonts loaded\n");
 }
 
+void OutTextFont(short startx, short starty, const std::wstring& text, const char * font, unsigned long color, unsigned short size)
+{
+	Font* f = FindFont(font);
+	if (f)
+	{
+		f->DrawText(size, startx, starty, text, color);
+	}
+}
+
+void OutTextFont(short startx, short starty, const std::string& text, const char * font, unsigned long color, unsigned short size)
+{
+	Font* f = FindFont(font);
+	if (f)
+	{
+		f->DrawText(size, startx, starty, text, color);
+	}
+}
+
+void OutTextFont(short startx, short starty, const char * text, const char * font, unsigned long color, unsigned short size)
+{
+	OutTextFont(startx, starty, std::string(text), font, color, size);
+}
+
 void OutText(short startx, short starty, const std::string &text, unsigned long color, unsigned short size)
 {
 	OutText(startx, starty, text.c_str(), color, size);
@@ -1070,10 +1728,10 @@ void OutText(short startx, short starty, const char * text, unsigned long color,
 {
 	DBG_PRINT("OutText %d %d %s %08X %d\n", startx, starty, text, color, size);
 
-	if (!fonts.empty())
+	if (Font* font = ActiveFont())
 	{
 		// Freetype font
-		fonts.front().DrawText(size, startx, starty, text, color);
+		font->DrawText(size, startx, starty, text, color);
 		return;
 	}
 	
@@ -1195,92 +1853,66 @@ bool ValidateInfoHeader(const BMPINFOHEADER &bmiHeader, const char * filename)
 	return true;
 }
 
-Image::Image() noexcept
-	: m_Texture(0)
-	, m_Initialized(false)
-	, m_Width(0)
-	, m_Height(0)
-{	
-}
-
-Image::Image(Image&& other) noexcept
-	: m_Texture(other.m_Texture)
-	, m_Width(other.m_Width)
-	, m_Height(other.m_Height)
-	, m_Initialized(other.m_Initialized)
-{
-	other.m_Initialized = false;
-	other.m_Texture = 0;
-	other.m_Width = 0;
-	other.m_Height = 0;
-}
+// GL 1.2 constants missing from the Windows GL header
+#ifndef GL_BGR
+#define GL_BGR 0x80E0
+#endif
+#ifndef GL_TEXTURE_MAX_LEVEL
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
 
-Image& Image::operator=(Image&& other) noexcept
-{
-	if (&other != this)
+// Image ready for upload.
+// Pixels are either decoded into the own buffer or used in place from the mapped file,
+// in the layout the GL can take directly (format, row alignment, row order).
+struct PixelData
+{
+	PixelData()
+		: data(nullptr)
+		, width(0)
+		, height(0)
+		, format(GL_RGBA)
+		, alignment(4)
+		, bottomUp(false)
 	{
-		this->m_Texture = other.m_Texture;
-		this->m_Initialized = other.m_Initialized;
-		this->m_Width = other.m_Width;
-		this->m_Height = other.m_Height;
-
-		other.m_Initialized = false;
-		other.m_Texture = 0;
-		other.m_Width = 0;
-		other.m_Height = 0;
 	}
 
-	return *this;
-}
+	std::vector<unsigned char> pixels;
+	MappedFile file;
 
-Image::~Image() noexcept
-{
-	if (m_Initialized && m_Texture != 0)
-	{
-		 glDeleteTextures(1, &m_Texture);
-		 m_Texture = 0;
-	}	
-}
+	// First row of the pixels
+	const unsigned char* data;
 
-bool Image::LoadBMP(const char * filename, bool transparent)
-{
-	DBG_PRINT("Image::LoadBMP [%s] %d", filename, transparent);	
+	unsigned int width;
+	unsigned int height;
 
-	std::ifstream in(filename, std::ios::binary | std::ios::in);
+	GLenum format;
+	unsigned int alignment;
+	bool bottomUp;
 
-	if (!in.is_open() || !in.good())
-	{
-		printf("Error [%d] opening file [%s]\n", errno, filename);
-		return false;
-	}
+	// Smaller mip levels, tightly packed RGBA (empty - no mip chain)
+	std::vector<std::vector<unsigned char> > mips;
+};
 
+// Decodes a BMP file in memory. Opaque images point into data,
+// so it has to outlive out
+bool DecodeBMP(const uint8_t * data, size_t size, const char * filename, bool transparent, PixelData& out)
+{
 	BMPHEADER bmHeader;
-	memset(&bmHeader,0,sizeof(BMPHEADER));
-
-	DBG_PRINT("Reading %u bytes (BMPHEADER) from [%s]\n", sizeof(BMPHEADER), filename);	
-	in.read((char*)&bmHeader,sizeof(BMPHEADER));
-	if (in.bad())
-	{
-		printf("Error [%d] reading file [%s]", errno, filename);
-		return false;		
-	}
+	BMPINFOHEADER bmiHeader;
 
-	if (bmHeader.bfType != 0x4d42)
+	if (size < sizeof(BMPHEADER) + sizeof(BMPINFOHEADER))
 	{
 		printf("Error. File [%s] is not a BMP file\n", filename);
 		return false;
 	}
 
-	BMPINFOHEADER bmiHeader;
-	memset(&bmiHeader,0,sizeof(BMPINFOHEADER));
-	
-	DBG_PRINT("Reading %u bytes (BMPINFOHEADER) from [%s]\n", sizeof(BMPINFOHEADER), filename);
+	memcpy(&bmHeader, data, sizeof(BMPHEADER));
+	memcpy(&bmiHeader, data + sizeof(BMPHEADER), sizeof(BMPINFOHEADER));
 
-	in.read((char*)&bmiHeader,sizeof(BMPINFOHEADER));
-	if (in.bad())
+	if (bmHeader.bfType != 0x4d42)
 	{
-		printf("Error [%d] reading file [%s]", errno, filename);
-		return false;		
+		printf("Error. File [%s] is not a BMP file\n", filename);
+		return false;
 	}
 
 	if (!ValidateInfoHeader(bmiHeader, filename))
@@ -1293,86 +1925,106 @@ bool Image::LoadBMP(const char * filename, bool transparent)
 	unsigned int width = bmiHeader.biWidth;
 	unsigned int height = bmiHeader.biHeight;
 
-	uint8_t * bmpPixels = new uint8_t[bmiHeader.biSizeImage];
-
-	in.seekg(bmHeader.bfOffBits);
-	in.read((char*)bmpPixels, bmiHeader.biSizeImage);
+	const size_t bmpRowWidth = ((size_t)width*3 + 3) & (~(size_t)3);
 
-	if (in.bad())
+	if (bmHeader.bfOffBits > size || (size - bmHeader.bfOffBits) / bmpRowWidth < height)
 	{
-		printf("Error [%d] reading file [%s]", errno, filename);
-		delete [] bmpPixels;
+		printf("Error. File [%s] is truncated\n", filename);
 		return false;
 	}
 
-	const int rowWidth = width*4;
+	const uint8_t * bmpPixels = data + bmHeader.bfOffBits;
 
-	uint8_t * pixels = new uint8_t[height*rowWidth];
+	out.width = width;
+	out.height = height;
 
-	const int bmpRowWidth = (width*3 + 3) & (~3);
+	if (!transparent)
+	{
+		// Uploaded as is: GL takes BGR rows padded to 4 bytes,
+		// the bottom-up order is handled by texture coordinates
+		out.data = bmpPixels;
+		out.format = GL_BGR;
+		out.alignment = 4;
+		out.bottomUp = true;
 
-	uint8_t transColor[3] = {
-		bmpPixels[(height-1)*bmpRowWidth + 2],
-		bmpPixels[(height-1)*bmpRowWidth + 1],
-		bmpPixels[(height-1)*bmpRowWidth + 0]
-	};
+		return true;
+	}
+
+	const size_t rowWidth = (size_t)width*4;
+
+	out.pixels.resize(height*rowWidth);
 
+	// Top left pixel is the transparent color
+	const uint8_t * topLeft = bmpPixels + (height-1)*bmpRowWidth;
+	const uint8_t transColor[3] = { topLeft[2], topLeft[1], topLeft[0] };
+
+	// BMP rows go bottom up
 	for (unsigned int row = 0; row < height; ++row)
 	{
-		for (unsigned int col = 0; col < width; ++col)
-		{
-			pixels[row * rowWidth + col*4 + 0] = bmpPixels[(height-row-1)*bmpRowWidth + col*3 + 2];
-			pixels[row * rowWidth + col*4 + 1] = bmpPixels[(height-row-1)*bmpRowWidth + col*3 + 1];
-			pixels[row * rowWidth + col*4 + 2] = bmpPixels[(height-row-1)*bmpRowWidth + col*3 + 0];
-
-			if (transparent &&
-					pixels[row * rowWidth + col*4 + 0] == transColor[0] &&
-					pixels[row * rowWidth + col*4 + 1] == transColor[1] &&
-					pixels[row * rowWidth + col*4 + 2] == transColor[2]
-					)
-			{
-				pixels[row * rowWidth + col*4 + 3] = 0;
-			}
-			else
-			{
-				pixels[row * rowWidth + col*4 + 3] = 0xff;
-			}
-		}
+		Pixels::BGRToRGBA(
+			bmpPixels + (height-row-1)*bmpRowWidth,
+			out.pixels.data() + row*rowWidth,
+			width,
+			transColor);
 	}
 
-	delete [] bmpPixels;
+	out.data = out.pixels.data();
 
-	/*******************GENERATING TEXTURES*******************/
-	GLuint texture;
+	return true;
+}
 
-	glGenTextures(1, &texture);             // Generate a texture
-	glBindTexture(GL_TEXTURE_2D, texture); // Bind that texture temporarily
+bool DecodeBMP(const char * filename, bool transparent, PixelData& out)
+{
+	// The file is mapped and either uploaded from the mapping
+	// or converted straight into the output buffer
+	MappedFile file;
+	if (!file.Open(filename))
+	{
+		return false;
+	}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	 
-	// Create the texture. We get the offsets from the image, then we use it with the image's
-	// pixel data to create it.
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	if (!DecodeBMP(file.Data(), file.Size(), filename, transparent, out))
+	{
+		return false;
+	}
 
-	// Unbind the texture
-	glBindTexture(GL_TEXTURE_2D, 0);
+	if (out.data != out.pixels.data())
+	{
+		out.file = std::move(file);
+	}
 
-	// Output a successful message
-	DBG_PRINT("Texture from [%s] (%u x %u) successfully loaded (tex %u).\n", filename, width, height, texture);
+	return true;
+}
 
-	delete [] pixels;
+bool DecodePNG(const unsigned char * data, size_t size, const char * filename, PixelData& out)
+{
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned res = lodepng::decode(out.pixels, width, height, data, size);
 
-	m_Texture = texture;
-	m_Initialized = true;
-	m_Width = width;
-	m_Height = height;
+	if (res)
+	{
+		printf("Error [%d] decoding file [%s]", res, filename);
+		return false;
+	}
+
+	DBG_PRINT("PNG file %s loaded (%u x %u).\n", filename, width, height);
+
+	out.data = out.pixels.data();
+	out.width = width;
+	out.height = height;
 
 	return true;
 }
 
-bool Image::LoadPNG(const char* filename)
+bool DecodePNG(const char * filename, PixelData& out)
 {
+	if (ImageCache::Open(filename, out.file, out.data, out.width, out.height))
+	{
+		DBG_PRINT("PNG file %s mapped from the cache (%u x %u).\n", filename, out.width, out.height);
+		return true;
+	}
+
 	std::vector<unsigned char> fileBuf;
 	{
 		int err = lodepng::load_file(fileBuf, filename);
@@ -1383,91 +2035,1499 @@ bool Image::LoadPNG(const char* filename)
 		}
 	}
 
-	std::vector<unsigned char> pngPixels;
-	unsigned int width = 0;
-	unsigned int height = 0;
-	unsigned res = lodepng::decode(pngPixels, width, height, fileBuf.data(), fileBuf.size());
-
-	if (res)
+	if (!DecodePNG(fileBuf.data(), fileBuf.size(), filename, out))
 	{
-		printf("Error [%d] decoding file [%s]", res, filename);
 		return false;
 	}
 
-	DBG_PRINT("PNG file %s loaded (%u x %u).\n", filename, width, height);
+	ImageCache::Store(filename, out.data, out.width, out.height);
 
-	/*******************GENERATING TEXTURES*******************/
-	GLuint texture;
+	return true;
+}
 
-	glGenTextures(1, &texture);             // Generate a texture
-	glBindTexture(GL_TEXTURE_2D, texture); // Bind that texture temporarily
+// Builds the mip chain down to 1x1 with a 2x2 box filter.
+// BGR pixels used from a mapped file are converted to RGBA first.
+void BuildMips(PixelData& image)
+{
+	if (image.format != GL_RGBA)
+	{
+		const size_t srcStride = ((size_t)image.width * 3 + image.alignment - 1) & ~((size_t)image.alignment - 1);
+		const size_t dstStride = (size_t)image.width * 4;
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		std::vector<unsigned char> pixels(dstStride * image.height);
+		for (unsigned int row = 0; row < image.height; ++row)
+		{
+			Pixels::BGRToRGBA(image.data + row * srcStride, pixels.data() + row * dstStride, image.width, nullptr);
+		}
 
-	// Create the texture. We get the offsets from the image, then we use it with the image's
-	// pixel data to create it.
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pngPixels.data());
+		image.pixels.swap(pixels);
+		image.data = image.pixels.data();
+		image.format = GL_RGBA;
+		image.alignment = 4;
+		image.file.Close();
+	}
 
-	// Unbind the texture
-	glBindTexture(GL_TEXTURE_2D, 0);
+	image.mips.clear();
 
-	DBG_PRINT("Texture from [%s] (%u x %u) successfully loaded (tex %u).\n", filename, width, height, texture);
+	const unsigned char* level = image.data;
+	unsigned int width = image.width;
+	unsigned int height = image.height;
 
-	m_Texture = texture;
-	m_Initialized = true;
-	m_Width = width;
-	m_Height = height;
+	while (width > 1 || height > 1)
+	{
+		const unsigned int nextWidth = width > 1 ? width / 2 : 1;
+		const unsigned int nextHeight = height > 1 ? height / 2 : 1;
+
+		std::vector<unsigned char> next((size_t)nextWidth * nextHeight * 4);
+		Pixels::HalveRGBA(level, width, height, next.data());
+
+		image.mips.push_back(std::move(next));
+
+		level = image.mips.back().data();
+		width = nextWidth;
+		height = nextHeight;
+	}
+}
+
+inline bool NeedsMips(Image::Filter filter)
+{
+	return filter == Image::Trilinear;
+}
+
+// Sets the sampling of the bound texture (trilinear needs a mip chain, otherwise it is linear)
+void SetTextureFilter(Image::Filter filter, bool mipmapped)
+{
+	GLint minFilter = GL_NEAREST;
+	GLint magFilter = GL_NEAREST;
+
+	switch (filter)
+	{
+	case Image::Trilinear:
+		minFilter = mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR;
+		magFilter = GL_LINEAR;
+		break;
+	case Image::Linear:
+		minFilter = GL_LINEAR;
+		magFilter = GL_LINEAR;
+		break;
+	case Image::Nearest:
+	default:
+		break;
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+}
+
+// Sets the unpack state for the pixel layout
+void SetUnpackState(const PixelData& image)
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, image.alignment);
+}
+
+void ResetUnpackState()
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Creates a texture from RGBA pixels (nullptr - uninitialized texture)
+GLuint CreateTexture(const unsigned char * pixels, unsigned int width, unsigned int height)
+{
+	GLuint texture;
+
+	glGenTextures(1, &texture);             // Generate a texture
+	glBindTexture(GL_TEXTURE_2D, texture); // Bind that texture temporarily
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	// Create the texture. We get the offsets from the image, then we use it with the image's
+	// pixel data to create it.
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+	// Unbind the texture
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return texture;
+}
+
+// Creates a texture from the image in its own layout, with its mip chain if it has one
+GLuint CreateTexture(const PixelData& image, Image::Filter filter)
+{
+	GLuint texture;
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	SetTextureFilter(filter, !image.mips.empty());
+
+	SetUnpackState(image);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, image.format == GL_RGBA ? GL_RGBA : GL_RGB,
+		image.width, image.height, 0, image.format, GL_UNSIGNED_BYTE, image.data);
+
+	ResetUnpackState();
+
+	// Mip levels are RGBA with 4-byte rows, uploaded level by level
+	unsigned int width = image.width;
+	unsigned int height = image.height;
+
+	for (size_t i = 0; i < image.mips.size(); ++i)
+	{
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+
+		glTexImage2D(GL_TEXTURE_2D, (GLint)(i + 1), GL_RGBA,
+			width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.mips[i].data());
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.mips.size());
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return texture;
+}
+
+// Access to Image internals for the loaders below
+struct ImageAccess
+{
+	static void SetTexture(Image& image, unsigned int texture, unsigned int width, unsigned int height, bool ownsTexture)
+	{
+		image.SetTexture(texture, width, height, ownsTexture);
+	}
+
+	static Image::Filter Filter(const Image& image)
+	{
+		return image.m_Filter;
+	}
+
+	static unsigned int Texture(const Image& image)
+	{
+		return image.m_Texture;
+	}
+
+	static unsigned int LastUse(const Image& image)
+	{
+		return image.m_LastUse;
+	}
+
+	static void SetTracked(Image& image, bool tracked, unsigned int frame)
+	{
+		image.m_Tracked = tracked;
+		image.m_LastUse = frame;
+	}
+
+	// Swaps the texture of a tracked image without touching its region and tracking
+	static void SetResidentTexture(Image& image, unsigned int texture, bool mipmapped)
+	{
+		image.m_Texture = texture;
+		image.m_Mipmapped = mipmapped;
+	}
+
+	// Gives the image a texture created from the pixel data
+	static void Assign(Image& image, unsigned int texture, const PixelData& data)
+	{
+		image.SetTexture(texture, data.width, data.height, true);
+		image.m_Mipmapped = !data.mips.empty();
+
+		if (data.bottomUp)
+		{
+			image.SetRegion(0.0f, 1.0f, 1.0f, 0.0f);
+		}
+	}
+};
+
+//
+// Texture residency
+//
+// Every image loaded from a file or a bundle remembers its source, so its texture
+// can be dropped when the textures go over the budget and loaded again when
+// the image is drawn next time. Least recently drawn textures are dropped first,
+// never the ones drawn in the current frame.
+//
+
+struct ImageSource
+{
+	enum Kind
+	{
+		BMP,
+		PNG,
+		Bundle
+	};
+
+	Kind kind;
+	std::string name;
+	bool transparent;
+
+	// Bundle of a Bundle source, kept mapped so the image loads again after UnmountBundles
+	std::shared_ptr<const Graph::Bundle> bundle;
+
+	// Texture memory (0 - the texture is evicted)
+	size_t bytes;
+	size_t residentBytes;
+};
+
+static std::unordered_map<const Image*, ImageSource> g_ResidentImages;
+
+static size_t g_TextureBudget = 0;
+static size_t g_ResidentBytes = 0;
+
+// Frame number, advanced on SwapBuffers
+static unsigned int g_Frame = 0;
+
+static TextureStats g_TextureStats = { 0, 0, 0, 0, 0 };
+
+static size_t TextureBytes(const PixelData& data)
+{
+	size_t bytes = (size_t)data.width * data.height * 4;
+	for (const auto& level : data.mips)
+	{
+		bytes += level.size();
+	}
+	return bytes;
+}
+
+void TrackResident(Image& image, ImageSource::Kind kind, const char * name, bool transparent, const PixelData& data,
+	std::shared_ptr<const Bundle> bundle = nullptr)
+{
+	ImageSource& source = g_ResidentImages[&image];
+
+	source.kind = kind;
+	source.name = name;
+	source.transparent = transparent;
+	source.bundle = std::move(bundle);
+	source.bytes = TextureBytes(data);
+	source.residentBytes = source.bytes;
+
+	g_ResidentBytes += source.bytes;
+
+	ImageAccess::SetTracked(image, true, g_Frame);
+}
+
+void UntrackResident(const Image * image)
+{
+	auto it = g_ResidentImages.find(image);
+	if (it == g_ResidentImages.end())
+		return;
+
+	g_ResidentBytes -= it->second.residentBytes;
+	g_ResidentImages.erase(it);
+}
+
+// Moves the tracking of an image to another object
+void RetargetResident(const Image * from, const Image * to)
+{
+	auto it = g_ResidentImages.find(from);
+	if (it == g_ResidentImages.end())
+		return;
+
+	ImageSource source = std::move(it->second);
+	g_ResidentImages.erase(it);
+	g_ResidentImages[to] = std::move(source);
+}
+
+bool DecodeBundleImage(const char * name, bool transparent, PixelData& data, std::shared_ptr<const Bundle>& bundle);
+
+// Loads the texture of an evicted image again
+static bool ReloadResident(Image& image, ImageSource& source)
+{
+	PixelData data;
+
+	bool ok = false;
+	switch (source.kind)
+	{
+	case ImageSource::BMP:
+		ok = DecodeBMP(source.name.c_str(), source.transparent, data);
+		break;
+	case ImageSource::PNG:
+		ok = DecodePNG(source.name.c_str(), data);
+		break;
+	case ImageSource::Bundle:
+		ok = DecodeBundleImage(source.name.c_str(), source.transparent, data, source.bundle);
+		break;
+	}
+
+	if (!ok)
+	{
+		printf("Error. Evicted texture of [%s] can not be loaded again\n", source.name.c_str());
+		return false;
+	}
+
+	const Image::Filter filter = ImageAccess::Filter(image);
+	if (NeedsMips(filter))
+	{
+		BuildMips(data);
+	}
+
+	GLuint texture = CreateTexture(data, filter);
+
+	ImageAccess::SetResidentTexture(image, texture, !data.mips.empty());
+
+	source.residentBytes = TextureBytes(data);
+	g_ResidentBytes += source.residentBytes;
+
+	return true;
+}
+
+// Marks the image as drawn in this frame, loads its texture if it was evicted.
+// Returns false if the image has no texture to draw
+bool TouchResident(const Image& image)
+{
+	// Only images with a source count as hits and misses
+	auto it = g_ResidentImages.find(&image);
+	if (it == g_ResidentImages.end())
+		return ImageAccess::Texture(image) != 0;
+
+	if (ImageAccess::Texture(image) != 0)
+	{
+		++g_TextureStats.hits;
+		ImageAccess::SetTracked(const_cast<Image&>(image), true, g_Frame);
+		return true;
+	}
+
+	++g_TextureStats.misses;
+
+	if (!ReloadResident(const_cast<Image&>(image), it->second))
+		return false;
+
+	ImageAccess::SetTracked(const_cast<Image&>(image), true, g_Frame);
+	return true;
+}
+
+void EnforceTextureBudget()
+{
+	const unsigned int frame = g_Frame++;
+
+	if (g_TextureBudget == 0 || g_ResidentBytes <= g_TextureBudget)
+		return;
+
+	std::vector<std::pair<unsigned int, const Image*> > candidates;
+	for (const auto& item : g_ResidentImages)
+	{
+		const Image* image = item.first;
+		if (item.second.residentBytes != 0 && ImageAccess::LastUse(*image) != frame)
+		{
+			candidates.push_back(std::make_pair(ImageAccess::LastUse(*image), image));
+		}
+	}
+
+	// Frame numbers wrap around, age is what matters
+	std::sort(candidates.begin(), candidates.end(),
+		[frame](const std::pair<unsigned int, const Image*>& a, const std::pair<unsigned int, const Image*>& b) {
+			return frame - a.first > frame - b.first;
+		});
+
+	for (const auto& candidate : candidates)
+	{
+		if (g_ResidentBytes <= g_TextureBudget)
+			break;
+
+		Image& image = const_cast<Image&>(*candidate.second);
+		ImageSource& source = g_ResidentImages[&image];
+
+		GLuint texture = ImageAccess::Texture(image);
+		glDeleteTextures(1, &texture);
+
+		ImageAccess::SetResidentTexture(image, 0, false);
+
+		g_ResidentBytes -= source.residentBytes;
+		source.residentBytes = 0;
+
+		++g_TextureStats.evictions;
+	}
+}
+
+void SetTextureBudget(size_t bytes)
+{
+	g_TextureBudget = bytes;
+}
+
+TextureStats GetTextureStats()
+{
+	TextureStats stats = g_TextureStats;
+	stats.residentBytes = g_ResidentBytes;
+	stats.budgetBytes = g_TextureBudget;
+	return stats;
+}
+
+void ResetTextureStats()
+{
+	g_TextureStats.hits = 0;
+	g_TextureStats.misses = 0;
+	g_TextureStats.evictions = 0;
+}
+
+//
+// Asynchronous image loading
+//
+
+struct AsyncLoad
+{
+	// Target image (main thread only), nullptr if the image was destroyed
+	Image* image;
+
+	std::string filename;
+	bool png;
+	bool transparent;
+	bool mips;
+
+	// Written by the worker before done is set
+	PixelData data;
+	bool ok;
+	std::atomic<bool> done;
+
+	std::promise<bool> promise;
+};
+
+static std::vector<std::shared_ptr<AsyncLoad> > g_AsyncLoads;
+
+// Moves pending loads of an image to another object (nullptr - the result is dropped)
+void RetargetAsyncLoads(const Image* from, Image* to)
+{
+	for (auto& load : g_AsyncLoads)
+	{
+		if (load->image == from)
+			load->image = to;
+	}
+}
+
+std::shared_future<bool> StartAsyncLoad(Image* image, const char* filename, bool png, bool transparent)
+{
+	std::shared_ptr<AsyncLoad> load = std::make_shared<AsyncLoad>();
+
+	load->image = image;
+	load->filename = filename;
+	load->png = png;
+	load->transparent = transparent;
+	load->mips = NeedsMips(ImageAccess::Filter(*image));
+	load->ok = false;
+	load->done = false;
+
+	std::shared_future<bool> result = load->promise.get_future().share();
+
+	g_AsyncLoads.push_back(load);
+
+	ThreadPool::Instance().Submit([load]() {
+		load->ok = load->png ?
+			DecodePNG(load->filename.c_str(), load->data) :
+			DecodeBMP(load->filename.c_str(), load->transparent, load->data);
+
+		if (load->ok && load->mips)
+		{
+			BuildMips(load->data);
+		}
+
+		load->done = true;
+	});
+
+	return result;
+}
+
+unsigned int PumpImageLoads(bool wait)
+{
+	if (!g_GraphEnabled) return (unsigned int)g_AsyncLoads.size();
+
+	for (;;)
+	{
+		size_t kept = 0;
+
+		for (size_t i = 0; i < g_AsyncLoads.size(); ++i)
+		{
+			std::shared_ptr<AsyncLoad> load = g_AsyncLoads[i];
+
+			if (!load->done)
+			{
+				g_AsyncLoads[kept++] = load;
+				continue;
+			}
+
+			bool ok = load->ok && load->image != nullptr;
+
+			if (ok)
+			{
+				const PixelData& data = load->data;
+
+				GLuint texture = CreateTexture(data, ImageAccess::Filter(*load->image));
+
+				DBG_PRINT("Texture from [%s] (%u x %u) successfully loaded (tex %u).\n", load->filename.c_str(), data.width, data.height, texture);
+
+				ImageAccess::Assign(*load->image, texture, data);
+				TrackResident(*load->image, load->png ? ImageSource::PNG : ImageSource::BMP, load->filename.c_str(), load->transparent, data);
+			}
+
+			// Frees the pixels (or unmaps the file)
+			load->data = PixelData();
+
+			load->promise.set_value(ok);
+		}
+
+		g_AsyncLoads.resize(kept);
+
+		if (!wait || g_AsyncLoads.empty())
+			break;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return (unsigned int)g_AsyncLoads.size();
+}
+
+// Fails all loads that have not been uploaded yet
+void CancelImageLoads()
+{
+	for (auto& load : g_AsyncLoads)
+	{
+		load->image = nullptr;
+		load->promise.set_value(false);
+	}
+
+	g_AsyncLoads.clear();
+}
+
+std::shared_future<bool> Image::LoadBMPAsync(const char * filename, bool transparent)
+{
+	DBG_PRINT("Image::LoadBMPAsync [%s] %d\n", filename, transparent);
+
+	return StartAsyncLoad(this, filename, false, transparent);
+}
+
+std::shared_future<bool> Image::LoadPNGAsync(const char* filename)
+{
+	DBG_PRINT("Image::LoadPNGAsync [%s]\n", filename);
+
+	return StartAsyncLoad(this, filename, true, false);
+}
+
+//
+// Bulk image loading
+//
+
+bool IsBMPFile(const char * filename)
+{
+	const size_t len = strlen(filename);
+	if (len < 4) return false;
+
+	const char* ext = filename + len - 4;
+	return ext[0] == '.' &&
+		(ext[1] == 'b' || ext[1] == 'B') &&
+		(ext[2] == 'm' || ext[2] == 'M') &&
+		(ext[3] == 'p' || ext[3] == 'P');
+}
+
+void SetImageCacheDir(const char * dir)
+{
+	ImageCache::SetDirectory(dir);
+}
+
+LoadStats LoadImages(const char * const * paths, unsigned int count, Image * images, unsigned int maxInFlight)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	LoadStats stats = { 0, 0, 0.0, 0.0, 0.0 };
+
+	if (!g_GraphEnabled)
+	{
+		stats.failed = count;
+		return stats;
+	}
+
+	ThreadPool& pool = ThreadPool::Instance();
+
+	if (maxInFlight == 0)
+	{
+		maxInFlight = pool.Size() * 2;
+	}
+
+	struct Job
+	{
+		PixelData data;
+		bool ok;
+		bool done;
+		double seconds;
+	};
+
+	struct Shared
+	{
+		std::vector<Job> jobs;
+		std::mutex mutex;
+		std::condition_variable cond;
+	};
+
+	std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+	shared->jobs.resize(count);
+
+	auto submit = [&](unsigned int index) {
+		const std::string path = paths[index];
+		const bool mips = NeedsMips(ImageAccess::Filter(images[index]));
+
+		pool.Submit([shared, index, path, mips]() {
+			const auto jobStart = std::chrono::steady_clock::now();
+
+			PixelData data;
+			const bool ok = IsBMPFile(path.c_str()) ?
+				DecodeBMP(path.c_str(), false, data) :
+				DecodePNG(path.c_str(), data);
+
+			if (ok && mips)
+			{
+				BuildMips(data);
+			}
+
+			const double seconds = SecondsSince(jobStart);
+
+			{
+				std::lock_guard<std::mutex> lock(shared->mutex);
+
+				Job& job = shared->jobs[index];
+				job.data = std::move(data);
+				job.ok = ok;
+				job.seconds = seconds;
+				job.done = true;
+			}
+
+			shared->cond.notify_all();
+		});
+	};
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		shared->jobs[i].done = false;
+	}
+
+	unsigned int submitted = 0;
+	while (submitted < count && submitted < maxInFlight)
+	{
+		submit(submitted++);
+	}
+
+	// Uploads in path order, every finished upload lets one more decode start
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		PixelData data;
+		bool ok;
+
+		{
+			std::unique_lock<std::mutex> lock(shared->mutex);
+
+			Job& job = shared->jobs[i];
+			shared->cond.wait(lock, [&job] { return job.done; });
+
+			data = std::move(job.data);
+			ok = job.ok;
+			stats.decodeSeconds += job.seconds;
+		}
+
+		if (submitted < count)
+		{
+			submit(submitted++);
+		}
+
+		if (!ok)
+		{
+			++stats.failed;
+			continue;
+		}
+
+		const auto uploadStart = std::chrono::steady_clock::now();
+
+		GLuint texture = CreateTexture(data, ImageAccess::Filter(images[i]));
+		ImageAccess::Assign(images[i], texture, data);
+		TrackResident(images[i], IsBMPFile(paths[i]) ? ImageSource::BMP : ImageSource::PNG, paths[i], false, data);
+
+		stats.uploadSeconds += SecondsSince(uploadStart);
+
+		++stats.loaded;
+	}
+
+	stats.totalSeconds = SecondsSince(start);
+
+	DBG_PRINT("LoadImages: %u loaded, %u failed, decode %.3f s, upload %.3f s, total %.3f s\n",
+		stats.loaded, stats.failed, stats.decodeSeconds, stats.uploadSeconds, stats.totalSeconds);
+
+	return stats;
+}
+
+Image::Image() noexcept
+	: m_Texture(0)
+	, m_Initialized(false)
+	, m_Width(0)
+	, m_Height(0)
+	, m_U0(0.0f)
+	, m_V0(0.0f)
+	, m_U1(1.0f)
+	, m_V1(1.0f)
+	, m_OwnsTexture(false)
+	, m_Filter(Nearest)
+	, m_Mipmapped(false)
+	, m_LastUse(0)
+	, m_Tracked(false)
+	, m_Stream(nullptr)
+{	
+}
+
+Image::Image(Image&& other) noexcept
+	: m_Texture(other.m_Texture)
+	, m_Width(other.m_Width)
+	, m_Height(other.m_Height)
+	, m_U0(other.m_U0)
+	, m_V0(other.m_V0)
+	, m_U1(other.m_U1)
+	, m_V1(other.m_V1)
+	, m_OwnsTexture(other.m_OwnsTexture)
+	, m_Filter(other.m_Filter)
+	, m_Mipmapped(other.m_Mipmapped)
+	, m_LastUse(other.m_LastUse)
+	, m_Tracked(other.m_Tracked)
+	, m_Stream(other.m_Stream)
+	, m_Initialized(other.m_Initialized)
+{
+	other.m_Initialized = false;
+	other.m_OwnsTexture = false;
+	other.m_Tracked = false;
+	other.m_Stream = nullptr;
+	other.m_Texture = 0;
+	other.m_Width = 0;
+	other.m_Height = 0;
+
+	RetargetAsyncLoads(&other, this);
+	RetargetResident(&other, this);
+}
+
+Image& Image::operator=(Image&& other) noexcept
+{
+	if (&other != this)
+	{
+		Release();
+
+		RetargetAsyncLoads(this, nullptr);
+		RetargetAsyncLoads(&other, this);
+
+		this->m_Texture = other.m_Texture;
+		this->m_Initialized = other.m_Initialized;
+		this->m_Width = other.m_Width;
+		this->m_Height = other.m_Height;
+		this->m_U0 = other.m_U0;
+		this->m_V0 = other.m_V0;
+		this->m_U1 = other.m_U1;
+		this->m_V1 = other.m_V1;
+		this->m_OwnsTexture = other.m_OwnsTexture;
+		this->m_Filter = other.m_Filter;
+		this->m_Mipmapped = other.m_Mipmapped;
+		this->m_LastUse = other.m_LastUse;
+		this->m_Tracked = other.m_Tracked;
+		this->m_Stream = other.m_Stream;
+
+		RetargetResident(&other, this);
+
+		other.m_Initialized = false;
+		other.m_OwnsTexture = false;
+		other.m_Tracked = false;
+		other.m_Stream = nullptr;
+		other.m_Texture = 0;
+		other.m_Width = 0;
+		other.m_Height = 0;
+	}
+
+	return *this;
+}
+
+Image::~Image() noexcept
+{
+	RetargetAsyncLoads(this, nullptr);
+
+	Release();
+}
+
+void Image::Release()
+{
+	if (m_Tracked)
+	{
+		UntrackResident(this);
+		m_Tracked = false;
+	}
+
+	ReleaseStream();
+
+	if (m_Initialized && m_OwnsTexture && m_Texture != 0)
+	{
+		 Batch::Flush();
+		 glDeleteTextures(1, &m_Texture);
+	}
+
+	m_Texture = 0;
+	m_Initialized = false;
+	m_OwnsTexture = false;
+	m_Mipmapped = false;
+}
+
+void Image::SetTexture(unsigned int texture, unsigned int width, unsigned int height, bool ownsTexture)
+{
+	Release();
+
+	m_Texture = texture;
+	m_Initialized = true;
+	m_OwnsTexture = ownsTexture;
+	m_Width = width;
+	m_Height = height;
+
+	SetRegion(0.0f, 0.0f, 1.0f, 1.0f);
+}
+
+//
+// Texture streaming
+//
+
+// Pixel buffers used in turn by Image::Update
+const unsigned int StreamBuffers = 2;
+
+struct Image::Stream
+{
+	GLuint buffers[StreamBuffers];
+	unsigned int next;
+};
+
+void Image::ReleaseStream()
+{
+	if (!m_Stream)
+		return;
+
+	// Buffers die with the context after CloseGraph()
+	const GLFuncs::Buffers* gl = g_GraphWindow ? GLFuncs::PixelBuffers() : nullptr;
+	if (gl)
+	{
+		gl->DeleteBuffers(StreamBuffers, m_Stream->buffers);
+	}
+
+	delete m_Stream;
+	m_Stream = nullptr;
+}
+
+// Copies rows of tightly packed RGBA pixels, in reverse order for bottom-up textures
+static void CopyRows(unsigned char * dst, const unsigned char * src, size_t rowBytes, unsigned int rows, bool reverse)
+{
+	if (!reverse)
+	{
+		memcpy(dst, src, rowBytes * rows);
+		return;
+	}
+
+	for (unsigned int row = 0; row < rows; ++row)
+	{
+		memcpy(dst + (rows - row - 1) * rowBytes, src + row * rowBytes, rowBytes);
+	}
+}
+
+bool Image::Create(unsigned int width, unsigned int height)
+{
+	if( !g_GraphEnabled ) return false;
+
+	GLuint texture = CreateTexture(nullptr, width, height);
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+	SetTextureFilter(m_Filter, false);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	SetTexture(texture, width, height, true);
+
+	return true;
+}
+
+bool Image::Update(const void * pixels)
+{
+	return Update(pixels, 0, 0, m_Width, m_Height);
+}
+
+bool Image::Update(const void * pixels, unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+	if( !g_GraphEnabled ) return false;
+
+	if( !m_Initialized ) return false;
+
+	if (!m_OwnsTexture)
+	{
+		printf("Error. Images in an atlas can not be updated\n");
+		return false;
+	}
+
+	if (width == 0 || height == 0 || x > m_Width || m_Width - x < width || y > m_Height || m_Height - y < height)
+	{
+		printf("Error. Update region (%u, %u) %u x %u is outside the image (%u x %u)\n", x, y, width, height, m_Width, m_Height);
+		return false;
+	}
+
+	// Updated pixels can not be loaded again from the source, the texture stays resident
+	if (m_Tracked)
+	{
+		if (m_Texture == 0 && !TouchResident(*this))
+			return false;
+
+		UntrackResident(this);
+		m_Tracked = false;
+	}
+
+	// Draws recorded with the old pixels go first
+	Batch::Flush();
+
+	// Bottom-up textures (BMP) keep rows in reverse order
+	const bool bottomUp = m_V0 > m_V1;
+	const unsigned int texY = bottomUp ? m_Height - y - height : y;
+
+	const size_t rowBytes = (size_t)width * 4;
+	const size_t size = rowBytes * height;
+
+	glBindTexture(GL_TEXTURE_2D, m_Texture);
+
+	bool uploaded = false;
+
+	const GLFuncs::Buffers* gl = GLFuncs::PixelBuffers();
+	if (gl)
+	{
+		if (!m_Stream)
+		{
+			m_Stream = new Stream();
+			gl->GenBuffers(StreamBuffers, m_Stream->buffers);
+			m_Stream->next = 0;
+		}
+
+		// Buffers are used in turn and orphaned before writing, so the copy never waits
+		// for the GPU to finish reading the pixels of the previous update
+		const GLuint buffer = m_Stream->buffers[m_Stream->next];
+		m_Stream->next = (m_Stream->next + 1) % StreamBuffers;
+
+		gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		gl->BufferData(GL_PIXEL_UNPACK_BUFFER, (ptrdiff_t)size, nullptr, GL_STREAM_DRAW);
+
+		unsigned char* dst = (unsigned char*)gl->MapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+		if (dst)
+		{
+			CopyRows(dst, (const unsigned char*)pixels, rowBytes, height, bottomUp);
+
+			// The buffer contents are lost if unmapping fails, the texture is left as is
+			uploaded = gl->UnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+
+			if (uploaded)
+			{
+				// Data pointer is the offset in the bound buffer
+				glTexSubImage2D(GL_TEXTURE_2D, 0, x, texY, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			}
+		}
+
+		gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	if (!uploaded)
+	{
+		if (bottomUp)
+		{
+			std::vector<unsigned char> rows(size);
+			CopyRows(rows.data(), (const unsigned char*)pixels, rowBytes, height, true);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x, texY, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rows.data());
+		}
+		else
+		{
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x, texY, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		}
+	}
+
+	// The mip chain no longer matches the pixels
+	if (m_Mipmapped)
+	{
+		SetTextureFilter(m_Filter, false);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		m_Mipmapped = false;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return true;
+}
+
+void Image::SetFilter(Filter filter)
+{
+	m_Filter = filter;
+
+	// Atlas pages are shared with other images and keep their own sampling
+	if (m_Initialized && m_OwnsTexture && m_Texture != 0)
+	{
+		Batch::Flush();
+
+		glBindTexture(GL_TEXTURE_2D, m_Texture);
+		SetTextureFilter(filter, m_Mipmapped);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+}
+
+Image::Filter Image::GetFilter() const
+{
+	return m_Filter;
+}
+
+void Image::SetRegion(float u0, float v0, float u1, float v1)
+{
+	m_U0 = u0;
+	m_V0 = v0;
+	m_U1 = u1;
+	m_V1 = v1;
+}
+
+bool Image::LoadBMP(const char * filename, bool transparent)
+{
+	DBG_PRINT("Image::LoadBMP [%s] %d", filename, transparent);	
+
+	PixelData data;
+	if (!DecodeBMP(filename, transparent, data))
+	{
+		return false;
+	}
+
+	if (NeedsMips(m_Filter))
+	{
+		BuildMips(data);
+	}
+
+	/*******************GENERATING TEXTURES*******************/
+	GLuint texture = CreateTexture(data, m_Filter);
+
+	// Output a successful message
+	DBG_PRINT("Texture from [%s] (%u x %u) successfully loaded (tex %u).\n", filename, data.width, data.height, texture);
+
+	ImageAccess::Assign(*this, texture, data);
+	TrackResident(*this, ImageSource::BMP, filename, transparent, data);
+
+	return true;
+}
+
+bool Image::LoadPNG(const char* filename)
+{
+	PixelData data;
+	if (!DecodePNG(filename, data))
+	{
+		return false;
+	}
+
+	if (NeedsMips(m_Filter))
+	{
+		BuildMips(data);
+	}
+
+	/*******************GENERATING TEXTURES*******************/
+	GLuint texture = CreateTexture(data, m_Filter);
+
+	DBG_PRINT("Texture from [%s] (%u x %u) successfully loaded (tex %u).\n", filename, data.width, data.height, texture);
+
+	ImageAccess::Assign(*this, texture, data);
+	TrackResident(*this, ImageSource::PNG, filename, false, data);
+
+	return true;
+}
+
+// Uploads pixels decoded from memory, the caller's buffer is only needed during the call
+static void UploadFromMemory(Image& image, PixelData& data)
+{
+	const Image::Filter filter = ImageAccess::Filter(image);
+	if (NeedsMips(filter))
+	{
+		BuildMips(data);
+	}
+
+	GLuint texture = CreateTexture(data, filter);
+
+	DBG_PRINT("Texture from memory (%u x %u) successfully loaded (tex %u).\n", data.width, data.height, texture);
+
+	ImageAccess::Assign(image, texture, data);
+}
+
+bool Image::LoadBMPFromMemory(const void * data, size_t size, bool transparent)
+{
+	// Opaque images are uploaded straight from the buffer
+	PixelData pixels;
+	if (!DecodeBMP((const uint8_t*)data, size, "<memory>", transparent, pixels))
+	{
+		return false;
+	}
+
+	UploadFromMemory(*this, pixels);
 
 	return true;
 }
 
-void Image::Draw(double x, double y) const
+bool Image::LoadPNGFromMemory(const void * data, size_t size)
 {
-	DrawTilted(x+m_Width/2, y+m_Height/2, m_Width, m_Height, 0);
+	PixelData pixels;
+	if (!DecodePNG((const unsigned char*)data, size, "<memory>", pixels))
+	{
+		return false;
+	}
+
+	UploadFromMemory(*this, pixels);
+
+	return true;
 }
 
-void Image::DrawTilted(double x, double y, double width, double height, double angle) const
+//
+// Bundles
+//
+
+// Mounted bundles, later ones take precedence.
+// Fonts registered from a bundle share it, so it stays mapped after UnmountBundles
+static std::vector<std::shared_ptr<Bundle> > g_Bundles;
+
+static const BundleFormat::Entry* FindBundleEntry(const char * name, std::shared_ptr<const Bundle>& owner)
 {
-	if( !g_GraphEnabled ) return;
+	for (auto it = g_Bundles.rbegin(); it != g_Bundles.rend(); ++it)
+	{
+		const BundleFormat::Entry* entry = (*it)->Find(name);
+		if (entry)
+		{
+			owner = *it;
+			return entry;
+		}
+	}
 
-	if( !m_Initialized ) return;
+	return nullptr;
+}
 
-	DBG_PRINT("Image::DrawTilted (tex %u, size %u, %u) %.1f %.1f %.1f %.1f %.1f\n", m_Texture, m_Width, m_Height, x, y, width, height, angle);
+bool MountBundle(const char * filename)
+{
+	std::shared_ptr<Bundle> bundle = std::make_shared<Bundle>();
+	if (!bundle->Open(filename))
+	{
+		return false;
+	}
 
-	glBindTexture(GL_TEXTURE_2D, m_Texture);
+	g_Bundles.push_back(std::move(bundle));
+	return true;
+}
+
+void UnmountBundles()
+{
+	g_Bundles.clear();
+}
+
+const unsigned char* FindBundleFile(const char * name, size_t * size)
+{
+	std::shared_ptr<const Bundle> bundle;
+	const BundleFormat::Entry* entry = FindBundleEntry(name, bundle);
+	if (!entry)
+	{
+		return nullptr;
+	}
+
+	if (size)
+	{
+		*size = (size_t)entry->dataSize;
+	}
+
+	return bundle->Data(*entry);
+}
+
+// Same as above, owner keeps the data mapped while referenced
+static const unsigned char* FindBundleFile(const char * name, size_t * size, std::shared_ptr<const Bundle>& owner)
+{
+	const BundleFormat::Entry* entry = FindBundleEntry(name, owner);
+	if (!entry)
+	{
+		return nullptr;
+	}
+
+	*size = (size_t)entry->dataSize;
+	return owner->Data(*entry);
+}
+
+// Decodes the bundle entry, pixels point into the mapping wherever the format allows.
+// The entry is looked up in bundle if it's set, otherwise in the mounted bundles,
+// and bundle is set to the one holding it
+bool DecodeBundleImage(const char * name, bool transparent, PixelData& data, std::shared_ptr<const Bundle>& bundle)
+{
+	const BundleFormat::Entry* entry = bundle ? bundle->Find(name) : FindBundleEntry(name, bundle);
+	if (!entry)
+	{
+		printf("Error. There is no [%s] in mounted bundles\n", name);
+		return false;
+	}
+
+	const unsigned char* bytes = bundle->Data(*entry);
+	const size_t size = (size_t)entry->dataSize;
+
+	if (entry->type == BundleFormat::RGBA)
+	{
+		if ((uint64_t)entry->width * entry->height * 4 != entry->dataSize)
+		{
+			printf("Error. Bundle entry [%s] has a wrong size\n", name);
+			return false;
+		}
+
+		data.data = bytes;
+		data.width = entry->width;
+		data.height = entry->height;
+	}
+	else if (size >= 2 && bytes[0] == 'B' && bytes[1] == 'M')
+	{
+		if (!DecodeBMP(bytes, size, name, transparent, data))
+		{
+			return false;
+		}
+	}
+	else if (!DecodePNG(bytes, size, name, data))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+bool Image::LoadFromBundle(const char * name, bool transparent)
+{
+	PixelData data;
+	std::shared_ptr<const Bundle> bundle;
+	if (!DecodeBundleImage(name, transparent, data, bundle))
+	{
+		return false;
+	}
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	if (NeedsMips(m_Filter))
+	{
+		BuildMips(data);
+	}
 
-	glPushMatrix();
+	GLuint texture = CreateTexture(data, m_Filter);
 
-	glTranslated(x,y,0.0);
-	glRotated(angle, 0.0, 0.0, -1.0);
+	DBG_PRINT("Texture from bundle entry [%s] (%u x %u) successfully loaded (tex %u).\n", name, data.width, data.height, texture);
 
-	glBegin(GL_POLYGON);
+	ImageAccess::Assign(*this, texture, data);
+	TrackResident(*this, ImageSource::Bundle, name, transparent, data, bundle);
 
-	glColor4f(1.0, 1.0, 1.0, 1.0);
+	return true;
+}
 
-	glTexCoord2f(0.0f, 0.0f);
-	glVertex2d(-width/2, -height/2);
+//
+// Image atlas
+//
 
-	glTexCoord2f(1.0f, 0.0f);
-	glVertex2d(width/2, -height/2);
+const int AtlasPadding = 1;
 
-	glTexCoord2f(1.0f, 1.0f);
-	glVertex2d(width/2, height/2);
+struct ImageAtlas::Impl
+{
+	struct Pending
+	{
+		Image* image;
+		PixelData data;
+	};
 
-	glTexCoord2f(0.0f, 1.0f);
-	glVertex2d(-width/2, height/2);
+	unsigned int pageSize;
 
-	glEnd();
+	std::vector<Pending> pending;
+	std::vector<GLuint> pages;
+};
 
-	glPopMatrix();
+ImageAtlas::ImageAtlas(unsigned int pageSize) noexcept
+	: m_Impl(new Impl)
+{
+	m_Impl->pageSize = pageSize;
+}
 
-	glDisable(GL_BLEND);
+ImageAtlas::~ImageAtlas() noexcept
+{
+	if (!m_Impl->pages.empty())
+	{
+		Batch::Flush();
+		glDeleteTextures((GLsizei)m_Impl->pages.size(), m_Impl->pages.data());
+	}
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	delete m_Impl;
+}
+
+bool ImageAtlas::AddBMP(Image& image, const char* filename, bool transparent)
+{
+	Impl::Pending item;
+	item.image = &image;
+
+	if (!DecodeBMP(filename, transparent, item.data))
+	{
+		return false;
+	}
+
+	m_Impl->pending.push_back(std::move(item));
+	return true;
+}
+
+bool ImageAtlas::AddPNG(Image& image, const char* filename)
+{
+	Impl::Pending item;
+	item.image = &image;
+
+	if (!DecodePNG(filename, item.data))
+	{
+		return false;
+	}
+
+	m_Impl->pending.push_back(std::move(item));
+	return true;
+}
+
+bool ImageAtlas::Build()
+{
+	if (!g_GraphEnabled) return false;
+
+	std::vector<Impl::Pending>& pending = m_Impl->pending;
+
+	// Tallest first packs shelves more densely
+	std::vector<size_t> order(pending.size());
+	for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+
+	std::stable_sort(order.begin(), order.end(), [&pending](size_t a, size_t b) {
+		return pending[a].data.height > pending[b].data.height;
+	});
+
+	struct Page
+	{
+		GLuint texture;
+		unsigned int width;
+		unsigned int height;
+		ShelfPacker packer;
+	};
+
+	std::vector<Page> pages;
+
+	for (size_t index : order)
+	{
+		Impl::Pending& item = pending[index];
+
+		const unsigned int width = item.data.width;
+		const unsigned int height = item.data.height;
+
+		size_t page = 0;
+		int x = 0;
+		int y = 0;
+
+		while (page < pages.size() && !pages[page].packer.Insert(width + AtlasPadding, height + AtlasPadding, x, y))
+		{
+			++page;
+		}
+
+		if (page == pages.size())
+		{
+			// Images bigger than a page get a page of their own
+			const unsigned int pageW = width + AtlasPadding > m_Impl->pageSize ? width + AtlasPadding : m_Impl->pageSize;
+			const unsigned int pageH = height + AtlasPadding > m_Impl->pageSize ? height + AtlasPadding : m_Impl->pageSize;
+
+			Page newPage = { CreateTexture(nullptr, pageW, pageH), pageW, pageH, ShelfPacker(pageW, pageH) };
+
+			if (newPage.texture == 0 || !newPage.packer.Insert(width + AtlasPadding, height + AtlasPadding, x, y))
+			{
+				printf("Error. Image atlas page (%u x %u) could not be created\n", pageW, pageH);
+				glDeleteTextures(1, &newPage.texture);
+				return false;
+			}
+
+			pages.push_back(newPage);
+			m_Impl->pages.push_back(newPage.texture);
+		}
+
+		const Page& target = pages[page];
+
+		glBindTexture(GL_TEXTURE_2D, target.texture);
+		SetUnpackState(item.data);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, item.data.format, GL_UNSIGNED_BYTE, item.data.data);
+		ResetUnpackState();
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		const float top = (float)y / target.height;
+		const float bottom = (float)(y + height) / target.height;
+
+		item.image->SetTexture(target.texture, width, height, false);
+		item.image->SetRegion(
+			(float)x / target.width,
+			item.data.bottomUp ? bottom : top,
+			(float)(x + width) / target.width,
+			item.data.bottomUp ? top : bottom);
+
+		item.data = PixelData();
+	}
+
+	DBG_PRINT("Image atlas: %u images packed into %u pages\n", (unsigned int)pending.size(), (unsigned int)pages.size());
+
+	pending.clear();
+
+	return true;
+}
+
+unsigned int ImageAtlas::PageCount() const
+{
+	return (unsigned int)m_Impl->pages.size();
+}
+
+void Image::Draw(double x, double y) const
+{
+	DrawTilted(x+m_Width/2, y+m_Height/2, m_Width, m_Height, 0);
+}
+
+void Image::DrawTilted(double x, double y, double width, double height, double angle) const
+{
+	DrawRegion(m_U0, m_V0, m_U1, m_V1, x, y, width, height, angle);
+}
+
+void Image::DrawRegion(float u0, float v0, float u1, float v1, double x, double y, double width, double height, double angle) const
+{
+	if( !g_GraphEnabled ) return;
+
+	if( !m_Initialized ) return;
+
+	if( m_Tracked && !TouchResident(*this) ) return;
+
+	DBG_PRINT("Image::DrawRegion (tex %u, size %u, %u) %.1f %.1f %.1f %.1f %.1f\n", m_Texture, m_Width, m_Height, x, y, width, height, angle);
+
+	// Corners are rotated on the CPU and recorded as a textured quad,
+	// consecutive sprites with the same texture go to GL as one draw call
+	double c = 1.0;
+	double s = 0.0;
+
+	if (angle != 0)
+	{
+		const int degrees = (int)angle;
+		if (degrees == angle)
+		{
+			const UnitPoint& p = DegreePoint(degrees);
+			c = p.c;
+			s = p.s;
+		}
+		else
+		{
+			c = cos(angle * M_PI / 180);
+			s = sin(angle * M_PI / 180);
+		}
+	}
+
+	const double hw = width / 2;
+	const double hh = height / 2;
+
+	const double corners[4][2] = {
+		{ -hw, -hh },
+		{  hw, -hh },
+		{  hw,  hh },
+		{ -hw,  hh }
+	};
+
+	const float uv[4][2] = {
+		{ u0, v0 },
+		{ u1, v0 },
+		{ u1, v1 },
+		{ u0, v1 }
+	};
+
+	Batch::Vertex* v = Batch::Append(Batch::Quads, m_Texture, 4);
+
+	for (int i = 0; i < 4; ++i)
+	{
+		const double dx = corners[i][0];
+		const double dy = corners[i][1];
+
+		Batch::Put(v[i],
+			(float)(x + dx*c + dy*s),
+			(float)(y - dx*s + dy*c),
+			uv[i][0], uv[i][1],
+			Color::White);
+	}
 }
 
 void DrawImage(const Image& image, short x, short y)
@@ -1495,6 +3555,156 @@ bool LoadBMPImageTransparent(Image& image, const char* filename)
 	return image.LoadBMP(filename, true);
 }
 
+//
+// Sprite sheets
+//
+
+SpriteSheet::SpriteSheet(const Image& image) noexcept
+	: m_Image(&image)
+{
+}
+
+unsigned int SpriteSheet::SliceGrid(unsigned int frameWidth, unsigned int frameHeight, unsigned int count)
+{
+	m_Frames.clear();
+
+	const unsigned int width = m_Image->m_Width;
+	const unsigned int height = m_Image->m_Height;
+
+	if (frameWidth == 0 || frameHeight == 0)
+		return 0;
+
+	const unsigned int columns = width / frameWidth;
+	const unsigned int rows = height / frameHeight;
+
+	if (count == 0 || count > columns * rows)
+		count = columns * rows;
+
+	m_Frames.reserve(count);
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		AddFrame((i % columns) * frameWidth, (i / columns) * frameHeight, frameWidth, frameHeight);
+	}
+
+	return count;
+}
+
+unsigned int SpriteSheet::AddFrame(unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+	Frame frame = { x, y, width, height };
+	m_Frames.push_back(frame);
+	return (unsigned int)m_Frames.size() - 1;
+}
+
+unsigned int SpriteSheet::FrameCount() const
+{
+	return (unsigned int)m_Frames.size();
+}
+
+void SpriteSheet::Draw(unsigned int frame, double x, double y) const
+{
+	if (frame >= m_Frames.size()) return;
+
+	const Frame& f = m_Frames[frame];
+	DrawTilted(frame, x + f.width / 2.0, y + f.height / 2.0, f.width, f.height, 0);
+}
+
+void SpriteSheet::DrawTilted(unsigned int frame, double x, double y, double width, double height, double angle) const
+{
+	if (frame >= m_Frames.size()) return;
+
+	const Image& image = *m_Image;
+	if (image.m_Width == 0 || image.m_Height == 0) return;
+
+	// Frame pixels are mapped into the image region, so sheets work with
+	// atlas images and bottom-up BMP textures alike
+	const Frame& f = m_Frames[frame];
+
+	const float du = (image.m_U1 - image.m_U0) / image.m_Width;
+	const float dv = (image.m_V1 - image.m_V0) / image.m_Height;
+
+	image.DrawRegion(
+		image.m_U0 + du * f.x,
+		image.m_V0 + dv * f.y,
+		image.m_U0 + du * (f.x + f.width),
+		image.m_V0 + dv * (f.y + f.height),
+		x, y, width, height, angle);
+}
+
+//
+// Sprite animation
+//
+
+SpriteAnimation::SpriteAnimation(const SpriteSheet& sheet, unsigned int firstFrame, unsigned int frameCount, double framesPerSecond, bool loop) noexcept
+	: m_Sheet(&sheet)
+	, m_FirstFrame(firstFrame)
+	, m_FrameCount(frameCount ? frameCount : 1)
+	, m_FramesPerSecond(framesPerSecond)
+	, m_Loop(loop)
+	, m_Start(glfwGetTime())
+	, m_PausedAt(0.0)
+	, m_Paused(false)
+{
+}
+
+void SpriteAnimation::Play()
+{
+	m_Start = glfwGetTime();
+	m_Paused = false;
+}
+
+void SpriteAnimation::Pause()
+{
+	if (m_Paused) return;
+
+	m_PausedAt = glfwGetTime();
+	m_Paused = true;
+}
+
+void SpriteAnimation::Resume()
+{
+	if (!m_Paused) return;
+
+	// The paused time does not count
+	m_Start += glfwGetTime() - m_PausedAt;
+	m_Paused = false;
+}
+
+unsigned int SpriteAnimation::Elapsed() const
+{
+	const double now = m_Paused ? m_PausedAt : glfwGetTime();
+	const double frames = (now - m_Start) * m_FramesPerSecond;
+
+	return frames > 0 ? (unsigned int)frames : 0;
+}
+
+bool SpriteAnimation::IsFinished() const
+{
+	return !m_Loop && Elapsed() >= m_FrameCount;
+}
+
+unsigned int SpriteAnimation::CurrentFrame() const
+{
+	const unsigned int elapsed = Elapsed();
+
+	const unsigned int frame = m_Loop ?
+		elapsed % m_FrameCount :
+		(elapsed < m_FrameCount ? elapsed : m_FrameCount - 1);
+
+	return m_FirstFrame + frame;
+}
+
+void SpriteAnimation::Draw(double x, double y) const
+{
+	m_Sheet->Draw(CurrentFrame(), x, y);
+}
+
+void SpriteAnimation::DrawTilted(double x, double y, double width, double height, double angle) const
+{
+	m_Sheet->DrawTilted(CurrentFrame(), x, y, width, height, angle);
+}
+
 void Mouse::SetCursorMode(Mouse::CursorMode mode)
 {
 	unsigned int glfw_mode = GLFW_CURSOR_NORMAL;
@@ -1524,11 +3734,11 @@ void Mouse::SetCursor(CursorType type)
 	unsigned int index = (unsigned int)type;
 	if (index >= (unsigned int)CursorType::Last)
 	{
-		glfwSetCursor(g_GraphWindow, cursors[0]);
+		glfwSetCursor(g_GraphWindow, GetCursor(0));
 	}
 	else
 	{
-		glfwSetCursor(g_GraphWindow, cursors[index]);
+		glfwSetCursor(g_GraphWindow, GetCursor(index));
 	}
 }
 
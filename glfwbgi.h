@@ -3,6 +3,8 @@
 #define GLFWBGI_H_INCLUDED
 
 #include <string>
+#include <vector>
+#include <future>
 
 namespace Graph
 {
@@ -35,6 +37,21 @@ bool ShouldClose();
 //    
 void CloseGraph();
 
+//   ( ).
+//     Mouse::SetCursor,   
+//             
+typedef struct
+{
+	double glfwInitSeconds;    //  GLFW
+	double windowSeconds;      //     OpenGL
+	double initGraphSeconds;   //  InitGraph()
+	double firstFrameSeconds;  //   InitGraph()   SwapBuffers() (0 -   )
+	double fontLoadSeconds;    //       (0 -   )
+	double fontWaitSeconds;    //      
+} StartupTiming;
+
+StartupTiming GetStartupTiming();
+
 //
 //      
 //
@@ -71,6 +88,11 @@ void Delay(long ms);
 //      
 void SetLineWidth(float thickness);
 
+//           :
+// maxError -       ( ),
+// minSegments  maxSegments -      
+void SetEllipseQuality(float maxError, unsigned short minSegments, unsigned short maxSegments);
+
 //     (x1,y1)   (x2,y2)  color
 void DrawLine(short x1, short y1, short x2, short y2, unsigned long color);
 
@@ -124,6 +146,50 @@ void FillEllipseChord(short x, short y, unsigned short xradius, unsigned short y
 //    - (x1,y1),    - (x2,y2)
 void FillRectangle(short x1, short y1, short x2, short y2, unsigned long color);
 
+//
+//  
+// (     ,     )
+//
+
+// :    - (x1,y1),    - (x2,y2)
+typedef struct
+{
+	short x1;
+	short y1;
+	short x2;
+	short y2;
+	unsigned long color;
+} RectItem;
+
+// ˳   (x1,y1)   (x2,y2)
+typedef struct
+{
+	short x1;
+	short y1;
+	short x2;
+	short y2;
+	unsigned long color;
+} LineItem;
+
+//    (x,y),   xradius    yradius
+typedef struct
+{
+	short x;
+	short y;
+	unsigned short xradius;
+	unsigned short yradius;
+	unsigned long color;
+} EllipseItem;
+
+//  count     rects
+void FillRectangles(const RectItem * rects, unsigned int count);
+
+//  count    lines
+void DrawLines(const LineItem * lines, unsigned int count);
+
+//  count     ellipses
+void FillEllipses(const EllipseItem * ellipses, unsigned int count);
+
 // ------------------
 // Image  
 // ------------------
@@ -134,6 +200,75 @@ bool LoadPNGImage(Image& image, const char* filename);
 
 bool LoadBMPImageTransparent(Image& image, const char* filename);
 
+//    ,    (. Image::LoadPNGAsync)
+//    SwapBuffers()
+// wait -    
+//    
+unsigned int PumpImageLoads(bool wait = false);
+
+//    
+typedef struct
+{
+	unsigned int loaded;      //   
+	unsigned int failed;      //  
+	double decodeSeconds;     //      (  )
+	double uploadSeconds;     //   
+	double totalSeconds;      //  
+} LoadStats;
+
+//  count    paths   images,
+//       .
+//      (.bmp - BMP,  PNG).
+//       .
+// maxInFlight -       '
+// (0 -      )
+LoadStats LoadImages(const char * const * paths, unsigned int count, Image * images, unsigned int maxInFlight = 0);
+
+//       dir (nullptr - ).
+//  PNG    RGBA    
+//   '  ,     (, ,  ).
+//  ,   .
+void SetImageCacheDir(const char* dir);
+
+//  ' .
+//  ,     ,    ,
+//   SwapBuffers(),      bytes (0 -  ),
+//       .
+void SetTextureBudget(size_t bytes);
+
+//   
+typedef struct
+{
+	unsigned long long hits;       //     
+	unsigned long long misses;     // ,      
+	unsigned long long evictions;  //   
+	size_t residentBytes;          //   
+	size_t budgetBytes;            //  (. SetTextureBudget)
+} TextureStats;
+
+TextureStats GetTextureStats();
+
+//   hits, misses, evictions
+void ResetTextureStats();
+
+//  :   (, )   ,
+//    '.    bundletool.
+//      ' - ,  bundletool ( '/').
+
+// ϳ  filename. ,  ,  
+bool MountBundle(const char* filename);
+
+// ³  .   ,  RegisterFont,
+//  ,  Image::LoadFromBundle,  
+//  ',      .
+// ,   FindBundleFile ,     
+void UnmountBundles();
+
+//    name        size
+// (nullptr -  ).  ,   .
+//   : Font font(data, size, name)
+const unsigned char* FindBundleFile(const char* name, size_t* size);
+
 void DrawImage(const Image& image, short x, short y);
 
 void DrawImageTilted(const Image& image, short x, short y, short width, short height, short angle);
@@ -141,6 +276,14 @@ void DrawImageTilted(const Image& image, short x, short y, short width, short he
 class Image
 {
 public:
+	// Գ    
+	enum Filter
+	{
+		Nearest,   //   ( )
+		Linear,    //  
+		Trilinear  //      (mip-)
+	};
+
 	Image() noexcept;
 	~Image() noexcept;
 
@@ -157,16 +300,185 @@ public:
 	bool LoadBMP(const char * filename, bool transparent = false);
 	bool LoadPNG(const char* filename);
 
+	//    BMP  PNG,     ' (data, size ).
+	//      .    
+	//  '  (. SetTextureBudget),      .
+	bool LoadBMPFromMemory(const void* data, size_t size, bool transparent = false);
+	bool LoadPNGFromMemory(const void* data, size_t size);
+
+	//  :       ,
+	//         SwapBuffers()  PumpImageLoads().
+	//  future   (true - ).      
+	//  PumpImageLoads(true) -    .
+	std::shared_future<bool> LoadBMPAsync(const char * filename, bool transparent = false);
+	std::shared_future<bool> LoadPNGAsync(const char* filename);
+
+	//   name    (. MountBundle).
+	//    BMP        .
+	bool LoadFromBundle(const char* name, bool transparent = false);
+
+	//    width x height (,  Update)
+	bool Create(unsigned int width, unsigned int height);
+
+	//    (   x, y, width, height)  pixels -
+	//  RGBA  4   ,  ,  .
+	//    ,  GPU    ,
+	//     (,  )   .
+	//      .
+	bool Update(const void* pixels);
+	bool Update(const void* pixels, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+
+	//  .  Trilinear mip-    
+	// (   -   ),      Load*().
+	//  mip- Trilinear   Linear.      .
+	void SetFilter(Filter filter);
+	Filter GetFilter() const;
+
 private:
+	friend class ImageAtlas;
+	friend class SpriteSheet;
+	friend struct ImageAccess;
+
+	//    (u0, v0) - (u1, v1)
+	void DrawRegion(float u0, float v0, float u1, float v1, double x, double y, double width, double height, double angle) const;
+
+	void SetTexture(unsigned int texture, unsigned int width, unsigned int height, bool ownsTexture);
+	void SetRegion(float u0, float v0, float u1, float v1);
+	void Release();
+	void ReleaseStream();
 
 	unsigned int m_Texture;
 
 	unsigned int m_Width;
 	unsigned int m_Height;
 
+	//  ,    (   )
+	float m_U0;
+	float m_V0;
+	float m_U1;
+	float m_V1;
+
+	bool m_OwnsTexture;
+
+	Filter m_Filter;
+	bool m_Mipmapped;
+
+	// ,      (. SetTextureBudget)
+	mutable unsigned int m_LastUse;
+	bool m_Tracked;
+
+	//   Update
+	struct Stream;
+	Stream* m_Stream;
+
 	bool m_Initialized;
 };
 
+//  :        ,
+//       .
+// ,   ,       Build()
+//   ,   .
+class ImageAtlas
+{
+public:
+	// pageSize -      ( )
+	ImageAtlas(unsigned int pageSize = 2048) noexcept;
+	~ImageAtlas() noexcept;
+
+	ImageAtlas(const ImageAtlas&) = delete;
+	ImageAtlas& operator=(const ImageAtlas&) = delete;
+
+	//       
+	// (' image      Build())
+	bool AddBMP(Image& image, const char* filename, bool transparent = false);
+	bool AddPNG(Image& image, const char* filename);
+
+	//       
+	bool Build();
+
+	// ʳ  
+	unsigned int PageCount() const;
+
+private:
+	struct Impl;
+	Impl* m_Impl;
+};
+
+//   ()   .
+//     ,    - (0, 0).
+//   ,   .
+//      ,    '.
+class SpriteSheet
+{
+public:
+	SpriteSheet(const Image& image) noexcept;
+
+	// ĳ    frameWidth x frameHeight     .
+	// count -   (0 - ,  ).   .
+	//   
+	unsigned int SliceGrid(unsigned int frameWidth, unsigned int frameHeight, unsigned int count = 0);
+
+	//       ,   
+	unsigned int AddFrame(unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+
+	unsigned int FrameCount() const;
+
+	//   frame  ,  Image::Draw / Image::DrawTilted
+	void Draw(unsigned int frame, double x, double y) const;
+	void DrawTilted(unsigned int frame, double x, double y, double width, double height, double angle) const;
+
+private:
+	struct Frame
+	{
+		unsigned int x;
+		unsigned int y;
+		unsigned int width;
+		unsigned int height;
+	};
+
+	const Image* m_Image;
+	std::vector<Frame> m_Frames;
+};
+
+// :  firstFrame .. firstFrame + frameCount - 1  sheet,
+//   framesPerSecond        Play().
+//   ,   .
+class SpriteAnimation
+{
+public:
+	SpriteAnimation(const SpriteSheet& sheet, unsigned int firstFrame, unsigned int frameCount, double framesPerSecond, bool loop = true) noexcept;
+
+	//   
+	void Play();
+
+	void Pause();
+	void Resume();
+
+	// true -      (  )
+	bool IsFinished() const;
+
+	//     
+	unsigned int CurrentFrame() const;
+
+	void Draw(double x, double y) const;
+	void DrawTilted(double x, double y, double width, double height, double angle) const;
+
+private:
+	// ʳ ,    
+	unsigned int Elapsed() const;
+
+	const SpriteSheet* m_Sheet;
+
+	unsigned int m_FirstFrame;
+	unsigned int m_FrameCount;
+	double m_FramesPerSecond;
+	bool m_Loop;
+
+	double m_Start;
+	double m_PausedAt;
+	bool m_Paused;
+};
+
 //
 // Color constants
 //  
@@ -479,6 +791,66 @@ void OutText(
 	unsigned short size = 12
 );
 
+//   ,  RegisterFont  ' font
+void OutTextFont(
+	short startx, short starty,
+	const char * text,
+	const char * font,
+	unsigned long color = Color::White,
+	unsigned short size = 12
+	);
+
+void OutTextFont(
+	short startx, short starty,
+	const std::string &text,
+	const char * font,
+	unsigned long color = Color::White,
+	unsigned short size = 12
+	);
+
+void OutTextFont(
+	short startx, short starty,
+	const std::wstring& text,
+	const char * font,
+	unsigned long color = Color::White,
+	unsigned short size = 12
+	);
+
+//     filename (TrueType, OpenType)  ' name.
+//    '         ,
+//     (MountBundle)    .
+//     .
+//     InitGraph()  ' "default".
+//  false,  '      
+bool RegisterFont(const char * name, const char * filename);
+
+//   name   OutText   
+bool SetFont(const char * name);
+
+//     
+typedef struct
+{
+	float width;    //  (    )
+	float height;   //   
+	float ascent;   //    
+	float descent;  //     ()
+} TextMetrics;
+
+//  ,  OutText   size,   :
+// ,  ,       ( ).
+//       .
+// font - '   (nullptr -  )
+TextMetrics MeasureText(const char * text, unsigned short size = 12, const char * font = nullptr);
+TextMetrics MeasureText(const std::string& text, unsigned short size = 12, const char * font = nullptr);
+TextMetrics MeasureText(const std::wstring& text, unsigned short size = 12, const char * font = nullptr);
+
+//       (distance field):
+//       baseSize
+//    -     .
+//   ,    ( , ).
+//   InitGraph()
+void SetTextDistanceField(bool enable, unsigned short baseSize = 48);
+
 //
 // Key constants
 //
@@ -112,6 +112,11 @@ int main()
 	OutText(10, 450, 'Q', Color::Pink, 28);
 	OutText(10, 500, "the quick brown fox jumps over the lazy dog! 1234567890", Color::Red, 28);
 
+	//    :    ,  
+	SetTextDistanceField(true);
+	OutText(10, 560, "distance field text 1234567890", Color::Yellow, 40);
+	SetTextDistanceField(false);
+
 	// 
 	Graph::Image image1;
 	if (LoadBMPImage(image1, "mario.bmp"))
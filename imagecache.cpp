@@ -0,0 +1,240 @@
+#include "imagecache.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <cstdint>
+#include <string>
+#include <mutex>
+#include <atomic>
+
+namespace Graph
+{
+namespace ImageCache
+{
+	const uint32_t BlobMagic = 0x43494247; // "GBIC"
+	const uint32_t BlobVersion = 1;
+
+	// Pixels start at this alignment after the header and the source path
+	const size_t PixelAlignment = 16;
+
+	struct BlobHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint32_t pathLength;
+		uint32_t reserved;
+	};
+
+	struct SourceInfo
+	{
+		uint64_t size;
+		int64_t time;
+	};
+
+	static std::mutex g_Lock;
+	static std::string g_Directory;
+
+	static std::atomic<unsigned int> g_TempCounter(0);
+
+	static std::string Directory()
+	{
+		std::lock_guard<std::mutex> lock(g_Lock);
+		return g_Directory;
+	}
+
+	static bool GetSourceInfo(const char* source, SourceInfo& info)
+	{
+#ifdef _WIN32
+		struct __stat64 st;
+		if (_stat64(source, &st) != 0)
+			return false;
+#else
+		struct stat st;
+		if (stat(source, &st) != 0)
+			return false;
+#endif
+		info.size = (uint64_t)st.st_size;
+		info.time = (int64_t)st.st_mtime;
+		return true;
+	}
+
+	static size_t PixelOffset(size_t pathLength)
+	{
+		return (sizeof(BlobHeader) + pathLength + PixelAlignment - 1) & ~(PixelAlignment - 1);
+	}
+
+	// Blob file name: 64-bit FNV-1a hash of the source path
+	static std::string BlobName(const std::string& directory, const char* source)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (const char* p = source; *p; ++p)
+		{
+			hash ^= (unsigned char)*p;
+			hash *= 1099511628211ull;
+		}
+
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.rgba", (unsigned long long)hash);
+
+		std::string path = directory;
+		if (path.back() != '/' && path.back() != '\\')
+			path += '/';
+
+		return path + name;
+	}
+
+	void SetDirectory(const char* directory)
+	{
+		std::string dir = directory ? directory : "";
+
+		if (!dir.empty())
+		{
+#ifdef _WIN32
+			_mkdir(dir.c_str());
+#else
+			mkdir(dir.c_str(), 0755);
+#endif
+		}
+
+		std::lock_guard<std::mutex> lock(g_Lock);
+		g_Directory = dir;
+	}
+
+	bool Enabled()
+	{
+		std::lock_guard<std::mutex> lock(g_Lock);
+		return !g_Directory.empty();
+	}
+
+	bool Open(const char* source, MappedFile& blob, const unsigned char*& pixels, unsigned int& width, unsigned int& height)
+	{
+		const std::string directory = Directory();
+		if (directory.empty())
+			return false;
+
+		SourceInfo info;
+		if (!GetSourceInfo(source, info))
+			return false;
+
+		// A missing blob is the usual miss, not an error worth reporting
+		const std::string blobName = BlobName(directory, source);
+
+		SourceInfo blobInfo;
+		if (!GetSourceInfo(blobName.c_str(), blobInfo))
+			return false;
+
+		MappedFile file;
+		if (!file.Open(blobName.c_str()))
+			return false;
+
+		if (file.Size() < sizeof(BlobHeader))
+			return false;
+
+		BlobHeader header;
+		memcpy(&header, file.Data(), sizeof(header));
+
+		const size_t pathLength = strlen(source);
+
+		if (header.magic != BlobMagic ||
+			header.version != BlobVersion ||
+			header.sourceSize != info.size ||
+			header.sourceTime != info.time ||
+			header.pathLength != pathLength)
+		{
+			return false;
+		}
+
+		const size_t offset = PixelOffset(pathLength);
+
+		if (file.Size() < offset + (size_t)header.width * header.height * 4 ||
+			memcmp(file.Data() + sizeof(BlobHeader), source, pathLength) != 0)
+		{
+			return false;
+		}
+
+		pixels = file.Data() + offset;
+		width = header.width;
+		height = header.height;
+		blob = std::move(file);
+
+		return true;
+	}
+
+	bool Store(const char* source, const unsigned char* pixels, unsigned int width, unsigned int height)
+	{
+		const std::string directory = Directory();
+		if (directory.empty())
+			return false;
+
+		SourceInfo info;
+		if (!GetSourceInfo(source, info))
+			return false;
+
+		const size_t pathLength = strlen(source);
+
+		BlobHeader header = {};
+		header.magic = BlobMagic;
+		header.version = BlobVersion;
+		header.width = width;
+		header.height = height;
+		header.sourceSize = info.size;
+		header.sourceTime = info.time;
+		header.pathLength = (uint32_t)pathLength;
+
+		const std::string blobName = BlobName(directory, source);
+
+		// Written under a unique name and renamed, so readers never see a partial blob
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%u.tmp", g_TempCounter++);
+		const std::string tempName = blobName + suffix;
+
+		FILE* file = fopen(tempName.c_str(), "wb");
+		if (!file)
+		{
+			printf("Error [%d] creating image cache file [%s]\n", errno, tempName.c_str());
+			return false;
+		}
+
+		const char padding[PixelAlignment] = {};
+		const size_t paddingSize = PixelOffset(pathLength) - sizeof(BlobHeader) - pathLength;
+		const size_t pixelsSize = (size_t)width * height * 4;
+
+		bool written =
+			fwrite(&header, sizeof(header), 1, file) == 1 &&
+			fwrite(source, 1, pathLength, file) == pathLength &&
+			fwrite(padding, 1, paddingSize, file) == paddingSize &&
+			fwrite(pixels, 1, pixelsSize, file) == pixelsSize;
+
+		written = (fclose(file) == 0) && written;
+
+		if (written && rename(tempName.c_str(), blobName.c_str()) != 0)
+		{
+			// Windows does not replace existing files on rename
+			remove(blobName.c_str());
+			written = rename(tempName.c_str(), blobName.c_str()) == 0;
+		}
+
+		if (!written)
+		{
+			printf("Error writing image cache file [%s]\n", blobName.c_str());
+			remove(tempName.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+} // namespace ImageCache
+} // namespace Graph
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "mappedfile.h"
+
+namespace Graph
+{
+	// Disk cache of decoded images
+	//
+	// Decoded RGBA pixels are stored as raw blobs in a cache directory, one file per
+	// source image, and mapped back on later runs instead of decoding the source again.
+	// A blob is valid while the source file path, size and modification time match.
+	namespace ImageCache
+	{
+		// Sets the cache directory and creates it when missing (nullptr or "" - cache is off)
+		void SetDirectory(const char* directory);
+
+		bool Enabled();
+
+		// Maps the cached pixels of the source file.
+		// Returns false when there is no valid blob for the file
+		bool Open(const char* source, MappedFile& blob, const unsigned char*& pixels, unsigned int& width, unsigned int& height);
+
+		// Writes decoded RGBA pixels of the source file to the cache
+		bool Store(const char* source, const unsigned char* pixels, unsigned int width, unsigned int height);
+	}
+}
@@ -7,10 +7,20 @@ cd build_macos
 g++ -std=c++14 -c -I../ ../glfwbgi.cpp
 g++ -std=c++14 -c -I../include ../freetype.cpp
 g++ -std=c++14 -c -I../include ../lodepng.cpp
+g++ -std=c++14 -c -I../include ../batch.cpp
+g++ -std=c++14 -c -I../include ../threadpool.cpp
+g++ -std=c++14 -c -I../include ../mappedfile.cpp
+g++ -std=c++14 -c -I../include ../pixels.cpp
+g++ -std=c++14 -c -I../include ../imagecache.cpp
+g++ -std=c++14 -c -I../include ../bundle.cpp
+g++ -std=c++14 -c -I../include ../glfuncs.cpp
 
 #Creating static lib
-ld -r -o libglfwbgi.a glfwbgi.o libglfw3.a freetype.o lodepng.o
+ld -r -o libglfwbgi.a glfwbgi.o libglfw3.a freetype.o lodepng.o batch.o threadpool.o mappedfile.o pixels.o imagecache.o bundle.o glfuncs.o
 
 
+#Building bundle tool
+g++ -std=c++14 -I.. ../bundletool.cpp ../lodepng.cpp -o bundletool
+
 #Building test app
 g++ -std=c++14 -stdlib=libc++ libglfwbgi.a -lfreetype -framework CoreVideo -framework OpenGL -framework IOKit -framework Cocoa -framework Carbon glfwtest.cpp -o glfwtest
\ No newline at end of file
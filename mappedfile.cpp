@@ -0,0 +1,177 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+
+namespace Graph
+{
+	MappedFile::MappedFile() noexcept
+		: m_Data(nullptr)
+		, m_Size(0)
+		, m_File(nullptr)
+		, m_Mapping(nullptr)
+	{
+	}
+
+	MappedFile::~MappedFile() noexcept
+	{
+		Close();
+	}
+
+	MappedFile::MappedFile(MappedFile&& other) noexcept
+		: m_Data(other.m_Data)
+		, m_Size(other.m_Size)
+		, m_File(other.m_File)
+		, m_Mapping(other.m_Mapping)
+	{
+		other.m_Data = nullptr;
+		other.m_Size = 0;
+		other.m_File = nullptr;
+		other.m_Mapping = nullptr;
+	}
+
+	MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+	{
+		if (&other != this)
+		{
+			Close();
+
+			m_Data = other.m_Data;
+			m_Size = other.m_Size;
+			m_File = other.m_File;
+			m_Mapping = other.m_Mapping;
+
+			other.m_Data = nullptr;
+			other.m_Size = 0;
+			other.m_File = nullptr;
+			other.m_Mapping = nullptr;
+		}
+
+		return *this;
+	}
+
+#ifdef _WIN32
+
+	bool MappedFile::Open(const char* filename)
+	{
+		Close();
+
+		HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			printf("Error [%lu] opening file [%s]\n", GetLastError(), filename);
+			return false;
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+		{
+			printf("Error. File [%s] is empty or its size is unknown\n", filename);
+			CloseHandle(file);
+			return false;
+		}
+
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr)
+		{
+			printf("Error [%lu] mapping file [%s]\n", GetLastError(), filename);
+			CloseHandle(file);
+			return false;
+		}
+
+		const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data == nullptr)
+		{
+			printf("Error [%lu] mapping file [%s]\n", GetLastError(), filename);
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+
+		m_Data = (const unsigned char*)data;
+		m_Size = (size_t)size.QuadPart;
+		m_File = file;
+		m_Mapping = mapping;
+
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+		if (m_Data)
+		{
+			UnmapViewOfFile(m_Data);
+			CloseHandle((HANDLE)m_Mapping);
+			CloseHandle((HANDLE)m_File);
+		}
+
+		m_Data = nullptr;
+		m_Size = 0;
+		m_File = nullptr;
+		m_Mapping = nullptr;
+	}
+
+#else
+
+	bool MappedFile::Open(const char* filename)
+	{
+		Close();
+
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+		{
+			printf("Error [%d] opening file [%s]\n", errno, filename);
+			return false;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			printf("Error. File [%s] is empty or its size is unknown\n", filename);
+			close(fd);
+			return false;
+		}
+
+		void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		// The mapping stays valid without the descriptor
+		close(fd);
+
+		if (data == MAP_FAILED)
+		{
+			printf("Error [%d] mapping file [%s]\n", errno, filename);
+			return false;
+		}
+
+		m_Data = (const unsigned char*)data;
+		m_Size = (size_t)st.st_size;
+
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+		if (m_Data)
+		{
+			munmap((void*)m_Data, m_Size);
+		}
+
+		m_Data = nullptr;
+		m_Size = 0;
+		m_File = nullptr;
+		m_Mapping = nullptr;
+	}
+
+#endif
+}
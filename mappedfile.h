@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+namespace Graph
+{
+	// Read-only memory mapping of a whole file
+	class MappedFile
+	{
+	public:
+		MappedFile() noexcept;
+		~MappedFile() noexcept;
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+
+		bool Open(const char* filename);
+		void Close();
+
+		const unsigned char* Data() const { return m_Data; }
+		size_t Size() const { return m_Size; }
+
+		bool IsOpen() const { return m_Data != nullptr; }
+
+	private:
+		const unsigned char* m_Data;
+		size_t m_Size;
+
+		// Platform handles
+		void* m_File;
+		void* m_Mapping;
+	};
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+namespace Graph
+{
+	// Simple shelf packer: rectangles are placed left to right on horizontal shelves,
+	// a new shelf is opened below the last one when the current one is full
+	class ShelfPacker
+	{
+	public:
+		ShelfPacker(int width, int height)
+			: m_Width(width)
+			, m_Height(height)
+			, m_ShelfY(0)
+			, m_ShelfHeight(0)
+			, m_CursorX(0)
+		{
+		}
+
+		bool Insert(int width, int height, int& x, int& y)
+		{
+			if (width > m_Width || height > m_Height)
+				return false;
+
+			if (m_CursorX + width > m_Width)
+			{
+				// Open a new shelf
+				m_ShelfY += m_ShelfHeight;
+				m_ShelfHeight = 0;
+				m_CursorX = 0;
+			}
+
+			if (m_ShelfY + height > m_Height)
+				return false;
+
+			x = m_CursorX;
+			y = m_ShelfY;
+
+			m_CursorX += width;
+			if (height > m_ShelfHeight)
+				m_ShelfHeight = height;
+
+			return true;
+		}
+
+	private:
+		int m_Width;
+		int m_Height;
+
+		int m_ShelfY;
+		int m_ShelfHeight;
+		int m_CursorX;
+	};
+}
@@ -0,0 +1,192 @@
+#include "pixels.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXELS_X86
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_SSE2
+#endif
+
+namespace Graph
+{
+namespace Pixels
+{
+	static void BGRToRGBAScalar(const uint8_t* src, uint8_t* dst, unsigned int width, const uint8_t* key)
+	{
+		for (unsigned int col = 0; col < width; ++col, src += 3, dst += 4)
+		{
+			dst[0] = src[2];
+			dst[1] = src[1];
+			dst[2] = src[0];
+			dst[3] = (key && dst[0] == key[0] && dst[1] == key[1] && dst[2] == key[2]) ? 0 : 0xff;
+		}
+	}
+
+	// Rounds like _mm_avg_epu8, so both paths give the same result
+	static inline uint8_t Average(uint8_t a, uint8_t b)
+	{
+		return (uint8_t)((a + b + 1) >> 1);
+	}
+
+	static void HalveRowScalar(const uint8_t* row0, const uint8_t* row1, unsigned int width, unsigned int from, unsigned int to, uint8_t* dst)
+	{
+		for (unsigned int x = from; x < to; ++x)
+		{
+			const unsigned int x0 = 2 * x;
+			const unsigned int x1 = (x0 + 1 < width) ? x0 + 1 : x0;
+
+			for (unsigned int c = 0; c < 4; ++c)
+			{
+				dst[4 * x + c] = Average(
+					Average(row0[4 * x0 + c], row1[4 * x0 + c]),
+					Average(row0[4 * x1 + c], row1[4 * x1 + c]));
+			}
+		}
+	}
+
+#ifdef PIXELS_X86
+
+	// CPU features are checked once; the checks run from static initialization,
+	// so the GCC builtins need __builtin_cpu_init first
+	static bool HasSSE2()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		return (info[3] & (1 << 26)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2") != 0;
+#endif
+	}
+
+	static bool HasSSSE3()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 9)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("ssse3") != 0;
+#endif
+	}
+
+	static const bool g_HasSSE2 = HasSSE2();
+	static const bool g_HasSSSE3 = HasSSSE3();
+
+	// 4 output pixels per step: rows are averaged first, then even and odd pixels
+	TARGET_SSE2
+	static unsigned int HalveRowSSE2(const uint8_t* row0, const uint8_t* row1, unsigned int dstWidth, uint8_t* dst)
+	{
+		unsigned int x = 0;
+
+		for (; x + 4 <= dstWidth; x += 4)
+		{
+			const __m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+			const __m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + x * 8 + 16));
+			const __m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+			const __m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + x * 8 + 16));
+
+			const __m128 v0 = _mm_castsi128_ps(_mm_avg_epu8(a0, b0));
+			const __m128 v1 = _mm_castsi128_ps(_mm_avg_epu8(a1, b1));
+
+			const __m128i even = _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+			const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+			_mm_storeu_si128((__m128i*)(dst + x * 4), _mm_avg_epu8(even, odd));
+		}
+
+		return x;
+	}
+
+
+	// 4 pixels per shuffle: 12 source bytes of a 16-byte load become 16 RGBA bytes
+	TARGET_SSSE3
+	static unsigned int BGRToRGBASSSE3(const uint8_t* src, uint8_t* dst, unsigned int width, const uint8_t* key)
+	{
+		const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+		const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+
+		const __m128i keyColor = key ?
+			_mm_set1_epi32((int)(0xff000000u | ((uint32_t)key[2] << 16) | ((uint32_t)key[1] << 8) | key[0])) :
+			_mm_setzero_si128();
+
+		unsigned int col = 0;
+
+		// A 16-byte load at pixel col reads up to pixel col + 5, stay inside the row
+		for (; col + 6 <= width; col += 4)
+		{
+			__m128i px = _mm_loadu_si128((const __m128i*)(src + col * 3));
+			px = _mm_or_si128(_mm_shuffle_epi8(px, shuffle), alpha);
+
+			if (key)
+			{
+				const __m128i transparent = _mm_and_si128(_mm_cmpeq_epi32(px, keyColor), alpha);
+				px = _mm_andnot_si128(transparent, px);
+			}
+
+			_mm_storeu_si128((__m128i*)(dst + col * 4), px);
+		}
+
+		return col;
+	}
+
+#endif // PIXELS_X86
+
+	void BGRToRGBA(const uint8_t* src, uint8_t* dst, unsigned int width, const uint8_t* key)
+	{
+		unsigned int done = 0;
+
+#ifdef PIXELS_X86
+		if (g_HasSSSE3)
+		{
+			done = BGRToRGBASSSE3(src, dst, width, key);
+		}
+#endif
+
+		BGRToRGBAScalar(src + done * 3, dst + done * 4, width - done, key);
+	}
+
+	void HalveRGBA(const uint8_t* src, unsigned int width, unsigned int height, uint8_t* dst)
+	{
+		const unsigned int dstWidth = width > 1 ? width / 2 : 1;
+		const unsigned int dstHeight = height > 1 ? height / 2 : 1;
+
+		const size_t srcStride = (size_t)width * 4;
+
+		for (unsigned int y = 0; y < dstHeight; ++y)
+		{
+			const unsigned int y0 = 2 * y;
+			const unsigned int y1 = (y0 + 1 < height) ? y0 + 1 : y0;
+
+			const uint8_t* row0 = src + y0 * srcStride;
+			const uint8_t* row1 = src + y1 * srcStride;
+			uint8_t* out = dst + (size_t)y * dstWidth * 4;
+
+			unsigned int done = 0;
+
+#ifdef PIXELS_X86
+			// One pixel wide images have no pixel pairs to average
+			if (g_HasSSE2 && width > 1)
+			{
+				done = HalveRowSSE2(row0, row1, dstWidth, out);
+			}
+#endif
+
+			HalveRowScalar(row0, row1, width, done, dstWidth, out);
+		}
+	}
+
+} // namespace Pixels
+} // namespace Graph
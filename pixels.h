@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Graph
+{
+	// Pixel format conversions used by the image loaders.
+	// SSE2/SSSE3 are used when the CPU has them, otherwise plain C++.
+	namespace Pixels
+	{
+		// Converts one row of 24-bit BGR pixels to RGBA.
+		// Pixels equal to key (R,G,B) get alpha 0 when key is not nullptr, all others get 0xFF.
+		void BGRToRGBA(const uint8_t* src, uint8_t* dst, unsigned int width, const uint8_t* key);
+
+		// Next mip level of tightly packed RGBA pixels: each pixel of dst is the average of
+		// a 2x2 box of src. dst is max(1, width/2) x max(1, height/2), odd last rows and
+		// columns are dropped.
+		void HalveRGBA(const uint8_t* src, unsigned int width, unsigned int height, uint8_t* dst);
+	}
+}
@@ -0,0 +1,74 @@
+#include "threadpool.h"
+
+namespace Graph
+{
+	ThreadPool::ThreadPool(unsigned int threads)
+		: m_Stop(false)
+	{
+		if (threads == 0)
+			threads = 1;
+
+		for (unsigned int i = 0; i < threads; ++i)
+		{
+			m_Threads.emplace_back(&ThreadPool::Run, this);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stop = true;
+		}
+
+		m_Cond.notify_all();
+
+		for (auto& thread : m_Threads)
+		{
+			thread.join();
+		}
+	}
+
+	void ThreadPool::Submit(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Tasks.push_back(std::move(task));
+		}
+
+		m_Cond.notify_one();
+	}
+
+	unsigned int ThreadPool::Size() const
+	{
+		return (unsigned int)m_Threads.size();
+	}
+
+	ThreadPool& ThreadPool::Instance()
+	{
+		static ThreadPool pool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 1);
+		return pool;
+	}
+
+	void ThreadPool::Run()
+	{
+		for (;;)
+		{
+			std::function<void()> task;
+
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_Cond.wait(lock, [this] { return m_Stop || !m_Tasks.empty(); });
+
+				// Queued tasks are finished before the pool stops
+				if (m_Tasks.empty())
+					return;
+
+				task = std::move(m_Tasks.front());
+				m_Tasks.pop_front();
+			}
+
+			task();
+		}
+	}
+}
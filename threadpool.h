@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace Graph
+{
+	// Fixed set of worker threads executing submitted tasks in FIFO order
+	class ThreadPool
+	{
+	public:
+		explicit ThreadPool(unsigned int threads);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		void Submit(std::function<void()> task);
+
+		unsigned int Size() const;
+
+		// Workers shared by the library (one less than the hardware threads, at least one),
+		// created on first use
+		static ThreadPool& Instance();
+
+	private:
+		void Run();
+
+	private:
+		std::vector<std::thread> m_Threads;
+		std::deque<std::function<void()> > m_Tasks;
+
+		std::mutex m_Mutex;
+		std::condition_variable m_Cond;
+
+		bool m_Stop;
+	};
+}